@@ -0,0 +1,253 @@
+/**
+ * wou-bench - micro-benchmarks of the WOU protocol hot kernels
+ *
+ * Runs the host side of the protocol against the in-process emulator
+ * ("7i43u-emu"), so no board is required.  For every kernel and every
+ * frame size it reports the best of BENCH_RUNS runs as ns/op and MB/s.
+ *
+ * usage: wou-bench [kernel]
+ *   kernel: crcFast, crcSliced, wou_append, wou_eof, wouf_parse,
+ *           sync_scan
+ *           (all kernels by default)
+ **/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "config.h"
+#include "wou.h"
+
+#ifdef HAVE_LIBFTDI
+#include <ftdi.h>       // from libftdi
+#endif
+
+#include "wb_regs.h"
+#include "wou/board.h"
+#include "wou/crc.h"
+#include "wou/transport.h"
+
+#define BENCH_ADDR      0x2000          // free space of the emulated wishbone bus
+#define BENCH_MIN_NS    50000000ULL     // min duration of a run: 50ms
+#define BENCH_RUNS      5               // report the best of
+#define BENCH_SEED      1
+
+/**
+ * bench_t - a kernel under test
+ * @name:   kernel name, for the command line filter
+ * @setup:  prepare for @size; optional
+ * @op:     run the kernel once on @size bytes
+ **/
+typedef struct bench {
+    const char  *name;
+    void        (*setup) (board_t *b, int size);
+    void        (*op) (board_t *b, int size);
+} bench_t;
+
+// frame sizes from the smallest TYP_WOUF up to MAX_PSIZE
+static const int sizes[] = {7, 16, 32, 48, 64, 128, 192, MAX_PSIZE};
+
+static uint8_t data[WB_REG_SIZE];
+static uint8_t frame[WOUF_HDR_SIZE + 2 * MAX_PSIZE + CRC_SIZE];
+static int frame_size;
+static volatile uint16_t crc_sink;
+
+static uint64_t now_ns (void)
+{
+    struct timespec t;
+    clock_gettime (CLOCK_MONOTONIC, &t);
+    return ((uint64_t) t.tv_sec * 1000000000ULL + t.tv_nsec);
+}
+
+/**
+ * fill_wouf - append WB_WR_CMD packets until PLOAD_SIZE_TX reaches @size
+ **/
+static void fill_wouf (board_t *b, int size)
+{
+    int remain;
+    int dsize;
+    int addr;
+
+    remain = size - 3;  // {WOUF_COMMAND, TID, PLOAD_SIZE_RX}
+    addr = BENCH_ADDR;
+    while (remain > WOU_HDR_SIZE) {
+        dsize = remain - WOU_HDR_SIZE;
+        if (dsize > MAX_DSIZE) dsize = MAX_DSIZE;
+        wou_append (b, WB_WR_CMD, addr, dsize, data);
+        remain -= (WOU_HDR_SIZE + dsize);
+        addr += dsize;
+    }
+}
+
+/**
+ * build_rt_wouf - build an RX RT_WOUF with PLOAD_SIZE_TX of @size
+ *                 after @noise bytes without SYNC word
+ **/
+static void build_rt_wouf (int noise, int size)
+{
+    uint8_t     *p;
+    uint16_t    crc16;
+    uint16_t    addr;
+    int         remain;
+    int         dsize;
+    unsigned int seed;
+    int         i;
+
+    seed = BENCH_SEED;
+    for (i = 0; i < noise; i++) {
+        frame[i] = rand_r (&seed);
+        if (frame[i] == WOUF_SOFD) frame[i] = 0;
+    }
+    p = frame + noise;
+    p[0] = WOUF_PREAMBLE;
+    p[1] = WOUF_PREAMBLE;
+    p[2] = WOUF_SOFD;
+    p[3] = size;
+    p[4] = RT_WOUF;
+    p += 5;
+    remain = size - 1;
+    addr = BENCH_ADDR;
+    while (remain >= WOU_HDR_SIZE) {
+        dsize = remain - WOU_HDR_SIZE;
+        if (dsize > MAX_DSIZE) dsize = MAX_DSIZE;
+        p[0] = dsize;
+        memcpy (p + 1, &addr, WB_ADDR_SIZE);
+        memcpy (p + WOU_HDR_SIZE, data, dsize);
+        p += WOU_HDR_SIZE + dsize;
+        remain -= WOU_HDR_SIZE + dsize;
+        addr += dsize;
+    }
+    assert (remain == 0);
+    crc16 = crcFast (frame + noise + WOUF_HDR_SIZE - 1, 1 + size);
+    memcpy (p, &crc16, CRC_SIZE);
+    frame_size = p + CRC_SIZE - frame;
+}
+
+static void recv_frame (board_t *b)
+{
+    uint64_t target;
+
+    target = b->rd_dsize + frame_size;
+    emu_inject (b, frame, frame_size);
+    while (b->rd_dsize < target) {
+        wou_recv (b);
+    }
+}
+
+static void crc_op (board_t *b, int size)
+{
+    crc_sink = crcFast (data, size);
+}
+
+static void sliced_op (board_t *b, int size)
+{
+    crc_sink = crcSliced (data, size);
+}
+
+static void append_op (board_t *b, int size)
+{
+    fill_wouf (b, size);
+    wouf_init (b);      // drop the frame
+}
+
+static void eof_op (board_t *b, int size)
+{
+    fill_wouf (b, size);
+    wou_eof (b, TYP_WOUF);
+}
+
+static void parse_setup (board_t *b, int size)
+{
+    // RT_WOUF with [WOU] packets of read data
+    build_rt_wouf (0, size);
+}
+
+static void sync_setup (board_t *b, int size)
+{
+    // @size bytes of noise before the shortest RT_WOUF
+    build_rt_wouf (size, 1);
+}
+
+static void recv_op (board_t *b, int size)
+{
+    recv_frame (b);
+}
+
+static const bench_t benches[] = {
+    {"crcFast",     NULL,           crc_op},
+    {"crcSliced",   NULL,           sliced_op},
+    {"wou_append",  NULL,           append_op},
+    {"wou_eof",     NULL,           eof_op},
+    {"wouf_parse",  parse_setup,    recv_op},
+    {"sync_scan",   sync_setup,     recv_op},
+};
+
+static double bench_run (board_t *b, const bench_t *bench, int size)
+{
+    uint64_t    t0, dt;
+    uint64_t    iters;
+    uint64_t    i;
+    double      best;
+    int         run;
+
+    if (bench->setup) bench->setup (b, size);
+
+    // warm up, and find the iterations for BENCH_MIN_NS
+    iters = 1;
+    for (;;) {
+        t0 = now_ns ();
+        for (i = 0; i < iters; i++) bench->op (b, size);
+        dt = now_ns () - t0;
+        if (dt >= (BENCH_MIN_NS / 4)) break;
+        iters *= 2;
+    }
+    iters = iters * 4;
+
+    best = 0;
+    for (run = 0; run < BENCH_RUNS; run++) {
+        t0 = now_ns ();
+        for (i = 0; i < iters; i++) bench->op (b, size);
+        dt = now_ns () - t0;
+        if ((run == 0) || (((double) dt / iters) < best)) {
+            best = (double) dt / iters;
+        }
+    }
+    return (best);
+}
+
+int main (int argc, char **argv)
+{
+    wou_param_t w_param;
+    const char  *filter;
+    double      ns;
+    int         i, j;
+
+    filter = (argc > 1) ? argv[1] : NULL;
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t) (i * 7 + 1);
+    }
+
+    wou_init (&w_param, "7i43u-emu", 0, NULL);
+    if (wou_connect (&w_param) == -1) {
+        fprintf (stderr, "Connection failed\n");
+        exit (EXIT_FAILURE);
+    }
+
+    printf ("crc kernel: %s\n", crcKernel ());
+    printf ("%-12s %6s %12s %12s\n", "kernel", "size", "ns/op", "MB/s");
+    for (i = 0; i < sizeof(benches) / sizeof(bench_t); i++) {
+        if (filter && strcmp (filter, benches[i].name)) continue;
+        for (j = 0; j < sizeof(sizes) / sizeof(int); j++) {
+            ns = bench_run (w_param.board, &benches[i], sizes[j]);
+            printf ("%-12s %6d %12.1f %12.2f\n",
+                    benches[i].name, sizes[j], ns, sizes[j] * 1000.0 / ns);
+        }
+    }
+
+    wou_close (&w_param);
+    return (EXIT_SUCCESS);
+}
+
+// vim:sw=4:sts=4:et:
@@ -109,6 +109,9 @@
 #define RST_TID         0x01
 #define MAILBOX         0x02
 #define RT_WOUF         0x03    // REALTIME WOU-FRAME
+#define ARQ_SR          0x04    // SELECTIVE-REPEAT request/agreement: {ARQ_SR, WINDOW}
+#define SACK_WOUF       0x05    // SELECTIVE ACK: {SACK_WOUF, TID, BITMAP[8]}
+#define SACK_BITS       64      // BITMAP of SACK_WOUF: frames TID+1 ~ TID+64 held
 
 // GPIO register space: (8-bit GPIO for LEDs, purpose: test Wishbone protocol)
 #define GPIO_BASE       0x0000
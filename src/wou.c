@@ -82,11 +82,81 @@ void wou_cmd (wou_param_t *w_param, const uint8_t func, const uint16_t wb_addr,
   return;
 }
 
+/* read/write wishbone registers of a batch of commands */
+int wou_cmd_batch (wou_param_t *w_param, const wou_op_t *ops, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    if (((ops[i].func != WB_WR_CMD) && (ops[i].func != WB_RD_CMD))
+        || (ops[i].dsize > MAX_DSIZE)
+        || ((ops[i].func == WB_WR_CMD) && (ops[i].data == NULL))) {
+      ERRP ("ERROR invalid command %zu: func(0x%02X) wb_addr(0x%04X) dsize(%d)\n",
+            i, ops[i].func, ops[i].wb_addr, ops[i].dsize);
+      errno = EINVAL;
+      return -1;
+    }
+  }
+
+  wou_append_batch (w_param->board, ops, n);
+
+  return 0;
+}
+
+/* declares a FIFO port for merging writes to it */
+int wou_fifo_port (wou_param_t *w_param, const uint16_t wb_addr,
+                   const uint16_t max_dsize)
+{
+  if ((max_dsize == 0) || (max_dsize > MAX_DSIZE)) {
+    ERRP ("ERROR FIFO port(0x%04X) max_dsize(%d) out of 1 ~ %d\n",
+          wb_addr, max_dsize, MAX_DSIZE);
+    return -1;
+  }
+
+  return wou_fifo_add (w_param->board, wb_addr, max_dsize);
+}
+
+/* opens a command queue of a producer thread */
+int wou_producer_open (wou_param_t *w_param, wou_producer_t *prod)
+{
+    prod->stage = board_stage_open (w_param->board);
+    if (prod->stage == NULL) {
+        return -1;
+    }
+    return 0;
+}
+
+/* read/write multiple wishbone registers from a producer thread */
+int wou_producer_cmd (wou_producer_t *prod, const uint8_t func,
+                      const uint16_t wb_addr, const uint16_t dsize,
+                      const uint8_t *data)
+{
+  if (dsize > MAX_DSIZE) {
+    ERRP ("ERROR Trying to write to too many registers (%d > %d)\n",
+          dsize, MAX_DSIZE);
+    errno = EINVAL;
+    return -1;
+  }
+
+  return board_stage_cmd (prod->stage, func, wb_addr, dsize, data);
+}
+
+/* closes the command queue of a producer thread */
+void wou_producer_close (wou_producer_t *prod)
+{
+    board_stage_close (prod->stage);
+    prod->stage = NULL;
+}
+
 /**
  * wou_update - update wou registers if it's appeared in USB RX BUF
  **/
 void wou_update (wou_param_t *w_param)
 {
+    if (w_param->board->io_run) {
+        // the I/O thread does it
+        return;
+    }
     wou_recv (w_param->board);
     return;
 }
@@ -138,7 +208,33 @@ const void *wou_reg_ptr (wou_param_t *w_param, uint32_t wou_addr)
 
 int wou_flush (wou_param_t *w_param)
 {
-    return wou_eof (w_param->board, TYP_WOUF); // typical WOU_FRAME;
+    return wou_eof_nb (w_param->board, TYP_WOUF); // typical WOU_FRAME;
+}
+
+/**
+ * wou_window - snapshot of the window occupancy
+ **/
+void wou_window (wou_param_t *w_param, wou_window_t *win)
+{
+    wou_window_get (w_param->board, win);
+    return;
+}
+
+/**
+ * wou_set_arq - ARQ mode to request at wou_connect()
+ **/
+void wou_set_arq (wou_param_t *w_param, int mode)
+{
+    w_param->board->wou->arq_req = mode;
+    return;
+}
+
+/**
+ * wou_arq - ARQ mode in effect
+ **/
+int wou_arq (wou_param_t *w_param)
+{
+    return LOAD_ACQ(&w_param->board->wou->arq);
 }
 
 /* Initializes the wou_param_t structure for USB
@@ -148,12 +244,34 @@ int wou_flush (wou_param_t *w_param)
 */
 void wou_init (wou_param_t *w_param, const char *device_type, 
                const int device_id, const char *bitfile)
+{
+    wou_init_config (w_param, device_type, device_id, bitfile, NULL);
+}
+
+/**
+ * wou_config_default - the sizes wou_init() uses
+ **/
+void wou_config_default (wou_config_t *cfg)
+{
+    board_config_default (cfg);
+    return;
+}
+
+/* Initializes the wou_param_t structure for USB, with sizes of @cfg */
+int wou_init_config (wou_param_t *w_param, const char *device_type,
+                     int device_id, const char *bitfile,
+                     const wou_config_t *cfg)
 {
     memset(w_param, 0, sizeof(wou_param_t));
     w_param->board = malloc(sizeof(board_t));
-    board_init(w_param->board, device_type, device_id, bitfile);
+    if (board_init(w_param->board, device_type, device_id, bitfile, cfg) != 0) {
+        free(w_param->board);
+        w_param->board = NULL;
+        return -1;
+    }
     wouf_init(w_param->board);
     rt_wouf_init(w_param->board);
+    return 0;
 }
 
 int wou_prog_risc(wou_param_t *w_param, const char *binfile)
@@ -221,4 +339,51 @@ void wou_close(wou_param_t *w_param)
     wou_close_usb(w_param);
 }
 
+/* Hands the link over to a library-owned I/O thread */
+int wou_io_thread_start (wou_param_t *w_param)
+{
+    return board_io_start (w_param->board);
+}
+
+/* Stops the I/O thread */
+void wou_io_thread_stop (wou_param_t *w_param)
+{
+    board_io_stop (w_param->board);
+}
+
+/* Initializes an empty board group */
+int wou_group_init (wou_group_t *group)
+{
+    group->group = calloc (1, sizeof(board_group_t));
+    if (group->group == NULL) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Adds a board to the group, before wou_connect() */
+int wou_group_add (wou_group_t *group, wou_param_t *w_param)
+{
+    return board_group_add (group->group, w_param->board);
+}
+
+/* wou_flush() of every board of the group */
+int wou_group_flush_all (wou_group_t *group)
+{
+    return board_group_flush (group->group, TYP_WOUF); // typical WOU_FRAME
+}
+
+/* One tick of the event loop of the group */
+int wou_group_poll (wou_group_t *group, int usec)
+{
+    return board_group_poll (group->group, usec);
+}
+
+/* Frees the group */
+void wou_group_free (wou_group_t *group)
+{
+    free (group->group);
+    group->group = NULL;
+}
+
 // vim:sw=4:sts=4:et:
@@ -62,6 +62,32 @@ void rt_wou_flush (wou_param_t *w_param);
 void wou_cmd (wou_param_t *w_param, const uint8_t func, const uint16_t wb_addr, 
              const uint16_t dsize, const uint8_t *data);
 
+/* one command of wou_cmd_batch() */
+typedef struct {
+        uint8_t         func;           /* WB_WR_CMD or WB_RD_CMD */
+        uint16_t        wb_addr;
+        uint16_t        dsize;          /* up to MAX_DSIZE */
+        const uint8_t   *data;          /* dsize bytes of WB_WR_CMD */
+} wou_op_t;
+
+/**
+ * wou_cmd_batch - wou_cmd() of @n commands in one call.  All of them are
+ *   checked first; a batch which fits a wou frame goes in one wou frame.
+ *   Returns 0, or -1 with errno EINVAL and nothing issued if a command
+ *   is invalid.
+ **/
+int wou_cmd_batch (wou_param_t *w_param, const wou_op_t *ops, size_t n);
+
+/**
+ * wou_fifo_port - declare @wb_addr a port taking a byte stream, such as
+ *   JCMD_SYNC_CMD, up to @max_dsize bytes in one write.  Writes to it
+ *   back to back in a wou frame go in one [WOU] packet; so do writes to
+ *   consecutive addresses, up to MAX_DSIZE bytes.  Up to 8 ports.
+ *   Returns 0 on success or -1 on failure.
+ **/
+int wou_fifo_port (wou_param_t *w_param, const uint16_t wb_addr,
+                   const uint16_t max_dsize);
+
 /**
  * wou_update - update wou registers if it's appeared in USB RX BUF
  **/
@@ -87,13 +113,52 @@ const void *wou_reg_ptr (wou_param_t *w_param, uint32_t wou_addr);
 //obsolete:  **/
 //obsolete: const void *wou_mbox_ptr (wou_param_t *w_param);
 
-/* wou_flush -
+/* wou_flush - close the pending wou frame and flush it to USB;
+ *  never blocks
  *  return value:
  *   0: There is still empty wou frame.
- *  -1: No empty wou frame.
+ *  -1: No empty wou frame; errno is EAGAIN.  The pending wou frame is
+ *      kept, and goes with a later wou_flush(), or with wou_cmd() once
+ *      it is full, which waits for an empty wou frame.  The commands of
+ *      producer threads without room in it stay queued for wou_flush().
 */
 int wou_flush (wou_param_t *w_param);
 
+/* occupancy of the wou frame window, see wou_window() */
+typedef struct {
+        int free_frames;        /* wou_flush() calls to succeed right now */
+        int pending_frames;     /* flushed, not sent yet */
+        int unacked_frames;     /* sent, waiting for ACK */
+        int queued_bytes;       /* bytes waiting for USB write */
+        int srtt_usec;          /* smoothed round trip time of a frame */
+        int rto_usec;           /* re-transmit timeout */
+        int tx_burst;           /* min size of a USB write, adaptive */
+        int rx_burst;           /* min size of a USB read, adaptive */
+} wou_window_t;
+
+/**
+ * wou_window - snapshot of the window occupancy, for deferring
+ *              low-priority traffic before wou_flush() returns -1
+ **/
+void wou_window (wou_param_t *w_param, wou_window_t *win);
+
+/* ARQ modes of the wou frame window, see wou_set_arq() */
+#define WOU_ARQ_GBN     0       /* GO-BACK-N */
+#define WOU_ARQ_SR      1       /* SELECTIVE-REPEAT */
+
+/**
+ * wou_set_arq - ARQ mode to request at wou_connect(), WOU_ARQ_GBN by
+ *               default.  WOU_ARQ_SR is for an FPGA built with ARQ_SR
+ *               only, which must agree to it; GO-BACK-N stays in effect
+ *               otherwise.  Call it before wou_connect().
+ **/
+void wou_set_arq (wou_param_t *w_param, int mode);
+
+/**
+ * wou_arq - ARQ mode in effect
+ **/
+int wou_arq (wou_param_t *w_param);
+
 /* Initializes the wou_param_t structure for USB
    @device_type: board name
    @device_id:   usb device id
@@ -102,6 +167,32 @@ int wou_flush (wou_param_t *w_param);
 void wou_init (wou_param_t *w_param, const char *device_type, 
                int device_id, const char *bitfile);
 
+/* sizes of the wou frame window and of the USB transfers, for tuning
+   latency against throughput per machine; see wou_init_config() */
+typedef struct wou_config {
+        int window;             /* frames sent ahead of their ACK, 1 ~ 64 */
+        int frames;             /* wou frames buffered, window + 8 ~ 255 */
+        int tx_chunk_size;      /* hold new frames back above this many
+                                   bytes queued for USB write */
+        int tx_burst_min;       /* min size of a USB write; it adapts
+                                   up to tx_burst_max with the load */
+        int tx_burst_max;       /* max size of a USB write */
+        int rx_chunk_size;      /* max size of a USB read */
+        int rx_burst_min;       /* min size of a USB read; it adapts
+                                   up to rx_chunk_size with the load */
+} wou_config_t;
+
+/* fills @cfg with the sizes wou_init() uses */
+void wou_config_default (wou_config_t *cfg);
+
+/* Initializes the wou_param_t structure like wou_init(), with the sizes
+   of @cfg, or the defaults if (cfg == NULL).
+   Returns 0 on success or -1 on failure: an unknown device_type, or
+   sizes out of range. */
+int wou_init_config (wou_param_t *w_param, const char *device_type,
+                     int device_id, const char *bitfile,
+                     const wou_config_t *cfg);
+
 /* Establishes a wou connexion.
    Returns 0 on success or -1 on failure. */
 int wou_connect (wou_param_t *w_param);
@@ -109,10 +200,91 @@ int wou_connect (wou_param_t *w_param);
 /* Closes a wou connection */
 void wou_close (wou_param_t *w_param);
 
+/* Hands the link over to a library-owned I/O thread, which runs the USB
+   events, GO-BACK-N and RX parsing.  From then on, wou_flush() and
+   rt_wou_cmd()/rt_wou_flush() only queue finished frames, and never wait
+   for USB; wou_update() is a no-op.  wou_cmd() still sleeps until the
+   I/O thread frees a wou frame if it fills one while the window is full.
+   The mailbox and CRC error callbacks are called from the I/O thread,
+   and the registers of wou_reg_ptr() are updated by it.  The rt_cmd
+   callback stays on the thread issuing wou commands, see
+   wou_set_rt_cmd_cb().
+   Call it after wou_connect(), from the thread issuing wou commands.
+   Returns 0 on success or -1 on failure. */
+int wou_io_thread_start (wou_param_t *w_param);
+
+/* Stops the I/O thread; wou_close() does it as well */
+void wou_io_thread_stop (wou_param_t *w_param);
+
+/* a command queue of one producer thread, see wou_producer_open() */
+typedef struct {
+        struct wou_stage* stage;
+} wou_producer_t;
+
+/* Opens a command queue for issuing wou commands from a thread other
+   than the one of wou_cmd()/wou_flush(), the framer.  Up to 8 queues
+   per board; each belongs to one producer thread.
+   Returns 0 on success or -1 on failure. */
+int wou_producer_open (wou_param_t *w_param, wou_producer_t *prod);
+
+/* wou_cmd() of a producer thread: stages the command in the queue of
+   @prod; lock-free, and never waits for USB.  wou_flush() of the framer
+   merges the commands of the period into its wou frame: the wou_cmd()
+   of the framer first, then every queue in the order of
+   wou_producer_open(), each in the order of staging.  Commands beyond
+   the room of the wou frame go with the next ones, as long as the
+   window has empty wou frames.
+   Returns 0, or -1 with errno EAGAIN if the queue is full, or with
+   errno EINVAL if dsize is above MAX_DSIZE. */
+int wou_producer_cmd (wou_producer_t *prod, const uint8_t func,
+                      const uint16_t wb_addr, const uint16_t dsize,
+                      const uint8_t *data);
+
+/* Closes the queue; the commands staged already still go out */
+void wou_producer_close (wou_producer_t *prod);
+
+/* boards driven by one event loop: one libusb context, and one poll of
+   USB events per tick for all of them, see wou_group_init() */
+typedef struct {
+        struct board_group* group;
+} wou_group_t;
+
+/* Initializes an empty board group.
+   Returns 0 on success or -1 on failure. */
+int wou_group_init (wou_group_t *group);
+
+/* Adds a board of wou_init() to the group, up to 8 boards.  Call it
+   before wou_connect(), for the board to share the libusb context of
+   the group; a board connected already is polled on its own.
+   Returns 0 on success or -1 on failure: the group is full, or the
+   board is in a group already. */
+int wou_group_add (wou_group_t *group, wou_param_t *w_param);
+
+/* wou_flush() of every board of the group, sent with one poll of USB
+   events for all of them; never blocks.
+   Returns 0, or -1 with errno EAGAIN if a board has no empty wou frame;
+   its pending wou frame is kept, as wou_flush() does. */
+int wou_group_flush_all (wou_group_t *group);
+
+/* One tick of the event loop: handles USB events once, then runs
+   GO-BACK-N TX and RX of every board; it replaces wou_update() of each
+   board.  Waits up to @usec for USB events if no board moved.  Boards
+   handed to wou_io_thread_start() are skipped.
+   Returns the number of boards with data written or received. */
+int wou_group_poll (wou_group_t *group, int usec);
+
+/* Frees the group; wou_close() its boards first */
+void wou_group_free (wou_group_t *group);
+
 /* prog risc core */
 int wou_prog_risc(wou_param_t *w_param, const char *binfile);
 
-/* set wou callback functions */
+/* set wou callback functions
+   mbox and crc_error: called while parsing RX, from wou_update(),
+   wou_cmd()/wou_flush() and rt_wou_cmd()/rt_wou_flush(), or from the I/O
+   thread once it is started.
+   rt_cmd: called once a wou frame is closed, always from the thread of
+   wou_cmd()/wou_flush()/wou_group_flush(). */
 void wou_set_mbox_cb (wou_param_t *w_param, libwou_mailbox_cb_fn callback);
 void wou_set_crc_error_cb (wou_param_t *w_param, libwou_crc_error_cb_fn callback);
 void wou_set_rt_cmd_cb (wou_param_t *w_param, libwou_rt_cmd_cb_fn callback);
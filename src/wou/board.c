@@ -61,6 +61,11 @@ information, go to www.linuxcnc.org.
 #include <sys/types.h>
 #include <time.h>
 #include <sys/param.h>  // for MIN() and MAX()
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include <libusb.h>
 #include <ftdi.h>       // from FTDI
@@ -69,6 +74,8 @@ information, go to www.linuxcnc.org.
 #include "bitfile.h"
 #include "wou.h"
 #include "board.h"
+#include "transport.h"
+#include "crc.h"
 
 // to disable DP(): #define TRACE 1
 // to dump more info: #define TRACE 2
@@ -99,20 +106,17 @@ static FILE *dptrace; // dptrace = fopen("dptrace.log","w");
 #define RECONNECT_TEST 0
 
 #if TX_ERR_TEST
-static uint32_t count_tx = 0;
 #define WOU_BREAK_COUNT 12
 #endif
 
 
 #if RX_ERR_TEST
-static uint32_t count_rx = 0;
 #define RX_ERR_COUNT 100
 #define RX_ERR_FRAME_NUM 1		//muse below NR_OF_WIN
 #endif
 
 
 #if TX_BREAK_SINGLE_TID
-static uint32_t count_single_break = 0;
 #define COUNT_START_BREAK 200
 #define COUNT_LEN 1
 #define SINGLE_BREAK_TID 0
@@ -120,38 +124,35 @@ static uint32_t count_single_break = 0;
 
 
 #if TX_FAIL_TEST
-static uint32_t count_tx_fail = 0;
 #define TX_FAIL_NUM_IN_ROW 10000
 #define TX_FAIL_COUNT 20  // 1: nothing will be sent
 #endif
 
 #if RECONNECT_TEST
-static uint32_t count_reconnect = 0;
 #define RECONNECT_COUNT 10
 #endif
 
 /*
 #define RX_FAIL_TEST 0
 #if TX_FAIL_TEST
-static uint32_t count_rx_fail = 0;
 #define RX_FAIL_NUM_IN_ROW 10000
 #define RX_FAIL_COUNT 2  // 1: nothing will be sent
 #endif
 */
 
 
-// for updating board_status:
-static struct timespec time_begin;
-static struct timespec time_send_begin;
-static struct timespec time_send_success; // time of a success send transfer
-
-static int prev_ss;
-
-#define TX_TIMEOUT   50000000
-// #define TX_TIMEOUT 19000000     // unit: nano-sec
+#define WOU_BUSY_NSEC 200000000 // report a stalled wou_eof() every 200ms
+#define WOU_WAIT_USEC 1000      // max sleep of wou_eof() between USB events
 #define BUF_SIZE 80             // the buffer size for tx_str[] and rx_str[]
 
 static int m7i43u_program_fpga(struct board *board, struct bitfile_chunk *ch);
+static void tx_reset (wou_t *wou);
+static int wouf_queue (board_t* b, int clk);
+static int64_t time_ns (void);
+static int stage_flush (board_t* b, uint8_t wouf_cmd);
+static int wouf_fits (const wouf_t *wou_frame_, const uint8_t func, const uint16_t dsize);
+static void wouf_put (board_t* b, wouf_t *wou_frame_, const uint8_t func, const uint16_t wb_addr,
+                      const uint16_t dsize, const uint8_t* buf);
 
 // 
 // this array describes all the boards we know how to program
@@ -162,6 +163,15 @@ struct board board_table[] = {
         .board_type = "7i43u\0",
         .chip_type = "3s400tq144\0",
         .io_type = IO_TYPE_USB,
+        .xport = &ftdi_transport,
+        .program_funct = m7i43u_program_fpga
+    },
+    {
+        // in-process emulator of 7i43u, for testing without hardware
+        .board_type = "7i43u-emu\0",
+        .chip_type = "3s400tq144\0",
+        .io_type = IO_TYPE_USB,
+        .xport = &emu_transport,
         .program_funct = m7i43u_program_fpga
     }
 };
@@ -240,10 +250,10 @@ int board_risc_prog(struct board* board, const char* binfile)
     wou_append (board, (const uint8_t) WB_WR_CMD, (const uint16_t)(JCMD_BASE | OR32_CTRL),
     		(const uint16_t)1, data); //wou_cmd
     // RESET TX_TIMEOUT:
-    clock_gettime(CLOCK_REALTIME, &time_send_begin);
+    clock_gettime(CLOCK_REALTIME, &board->wou->time_send_begin);
     while(wou_eof (board, TYP_WOUF) == -1)
     {
-        clock_gettime(CLOCK_REALTIME, &time_send_success);
+        clock_gettime(CLOCK_REALTIME, &board->wou->time_send_success);
     }
 
 
@@ -280,7 +290,7 @@ int board_risc_prog(struct board* board, const char* binfile)
             word_counter++;
             byte_counter=0;
             // issue an OR32_PROG command
-            clock_gettime(CLOCK_REALTIME, &time_send_success);
+            clock_gettime(CLOCK_REALTIME, &board->wou->time_send_success);
             wou_append (board, (const uint8_t)WB_WR_CMD, (const uint16_t)(JCMD_BASE | OR32_PROG),
             		(const uint16_t) 2*sizeof(uint32_t),  (const uint8_t*)data);//wou_cmd
         }
@@ -288,7 +298,7 @@ int board_risc_prog(struct board* board, const char* binfile)
                 word_counter = 0;
                 while(wou_eof (board, TYP_WOUF) == -1)
                 {
-                    clock_gettime(CLOCK_REALTIME, &time_send_success);
+                    clock_gettime(CLOCK_REALTIME, &board->wou->time_send_success);
                 }
                 DP ("current_addr(0x%08X)\n", current_addr);
         }
@@ -299,7 +309,7 @@ int board_risc_prog(struct board* board, const char* binfile)
         // terminate pending WOU commands
         while(wou_eof (board, TYP_WOUF) == -1)
         {
-            clock_gettime(CLOCK_REALTIME, &time_send_success);
+            clock_gettime(CLOCK_REALTIME, &board->wou->time_send_success);
         }
     }
 
@@ -309,7 +319,7 @@ int board_risc_prog(struct board* board, const char* binfile)
     		(const uint16_t)1, (const uint8_t*)&value); //wou_cmd
     while(wou_eof (board, TYP_WOUF) == -1)
     {
-        clock_gettime(CLOCK_REALTIME, &time_send_success);
+        clock_gettime(CLOCK_REALTIME, &board->wou->time_send_success);
     }
 
     DP ("start WOU ERROR generator\n");
@@ -385,42 +395,153 @@ static int board_prog (struct board* board)
 static void gbn_init (board_t* board)
 {
     int i;
-    int ret;
-    struct ftdi_context *ftdic;
-    ftdic = &(board->io.usb.ftdic);
     board->rd_dsize = 0;
     board->wr_dsize = 0;
-    board->wou->tx_size = 0;
-    board->wou->rx_size = 0;
+    board->wou->tx_xfer_cnt = 0;
+    tx_reset (board->wou);
+    board->wou->tx_head = 0;
+    board->wou->rt_head = 0;
+    board->wou->rt_q_head = 0;
+    board->wou->rt_q_tail = 0;
+    board->wou->rx_head = 0;
+    board->wou->rx_tail = 0;
     board->wou->rx_state = SYNC;
     board->wou->tid = 0xFF;
     board->wou->clock = 0;
     board->wou->Sn = 0;
     board->wou->Sb = 0;
-    board->wou->Sm = NR_OF_WIN - 1;
-    for (i=0; i<NR_OF_CLK; i++) {
+    board->wou->Sm = board->cfg.window - 1;
+    board->wou->arq = WOU_ARQ_GBN;  // until the FPGA agrees to ARQ_SR
+    board->wou->arq_tries = 0;
+    board->wou->arq_pending = 0;
+    board->wou->tx_seq = 0;
+    board->wou->srtt = 0;       // no RTT sample yet
+    board->wou->rttvar = 0;
+    board->wou->rto = RTO_INIT_NSEC;
+    clock_gettime(CLOCK_REALTIME, &board->wou->tx_poll);
+    // bursts start from the configured minimum, for latency
+    board->wou->tx_burst = board->cfg.tx_burst_min;
+    board->wou->rx_burst = board->cfg.rx_burst_min;
+    memset (&board->wou->burst, 0, sizeof(burst_stat_t));
+    board->wou->burst.begin = time_ns ();
+    for (i=0; i<board->cfg.frames; i++) {
         board->wou->woufs[i].use = 0;
+        board->wou->woufs[i].buf = board->wou->tx_ring;
+        board->wou->woufs[i].tx_seq = 0;
     }
     wouf_init (board);
     rt_wouf_init (board);
 
-    srand(time(NULL));
+    board->wou->err_seed = time(NULL);
 
     return;
 }
 
+/**
+ * arq_request - ask the FPGA for SELECTIVE-REPEAT, if wou_set_arq() wants it;
+ *               the FPGA answers with ARQ_SR.  The request is a frame type
+ *               unknown to an FPGA built without ARQ_SR, so it is only
+ *               sent on opt-in; GO-BACK-N is in effect until the answer
+ **/
+static void arq_request (board_t* board)
+{
+    uint8_t     *buf;
+    uint16_t    crc16;
+
+    if (board->wou->arq_req != WOU_ARQ_SR) return;
+
+    // {PREAMBLE_0, PREAMBLE_1, SOFD, PLOAD_SIZE_TX, ARQ_SR, WINDOW, CRC}
+    buf = board->wou->arq_buf;
+    buf[0] = WOUF_PREAMBLE;
+    buf[1] = WOUF_PREAMBLE;
+    buf[2] = WOUF_SOFD;
+    buf[3] = 2;
+    buf[4] = ARQ_SR;
+    buf[5] = board->cfg.window;
+    crc16 = crcFast (buf + (WOUF_HDR_SIZE - 1), 3);
+    memcpy (buf + WOUF_HDR_SIZE + 2, &crc16, CRC_SIZE);
+    board->wou->arq_pending = 1;
+}
+
+/**
+ * board_config_default - the compiled-in sizes of wou_config_t
+ **/
+void board_config_default (wou_config_t *cfg)
+{
+    cfg->window = NR_OF_WIN;
+    cfg->frames = NR_OF_CLK;
+    cfg->tx_chunk_size = TX_CHUNK_SIZE;
+    cfg->tx_burst_min = TX_BURST_MIN;
+    cfg->tx_burst_max = TX_BURST_MAX;
+    cfg->rx_chunk_size = RX_CHUNK_SIZE;
+    cfg->rx_burst_min = RX_BURST_MIN;
+}
+
+/**
+ * board_config_check - check the sizes of @cfg against the protocol
+ * returns: 0 if usable, -1 otherwise
+ **/
+static int board_config_check (const wou_config_t *cfg)
+{
+    if ((cfg->window < 1) || (cfg->window > NR_OF_WIN)) {
+        ERRP ("window(%d): 1 ~ %d\n", cfg->window, NR_OF_WIN);
+        return -1;
+    }
+    if ((cfg->frames < (cfg->window + NR_OF_CLK_GAP)) || (cfg->frames > NR_OF_CLK)) {
+        ERRP ("frames(%d): %d ~ %d\n", cfg->frames, cfg->window + NR_OF_CLK_GAP, NR_OF_CLK);
+        return -1;
+    }
+    if ((cfg->tx_burst_min < 1) || (cfg->tx_burst_max < cfg->tx_burst_min)
+        || (cfg->tx_chunk_size < cfg->tx_burst_min)) {
+        ERRP ("tx_burst_min(%d) tx_burst_max(%d) tx_chunk_size(%d)\n",
+              cfg->tx_burst_min, cfg->tx_burst_max, cfg->tx_chunk_size);
+        return -1;
+    }
+    if ((cfg->rx_burst_min < 1) || (cfg->rx_chunk_size < cfg->rx_burst_min)
+        || (cfg->rx_chunk_size > RX_CHUNK_MAX)) {
+        ERRP ("rx_burst_min(%d) rx_chunk_size(%d)\n",
+              cfg->rx_burst_min, cfg->rx_chunk_size);
+        return -1;
+    }
+    return 0;
+}
+
 int board_init (board_t* board, const char* device_type, const int device_id,
-                const char* bitfile)
+                const char* bitfile, const wou_config_t *cfg)
 {
     int found_device_type;
     int num_boards;
     int i;
+    wou_t *wou;
 
 #if (TRACE!=0)
     dptrace = fopen("wou.log","w");
     // dptrace = stderr;
 #endif
+    if (cfg) {
+        board->cfg = *cfg;
+    } else {
+        board_config_default (&board->cfg);
+    }
+    if (board_config_check (&board->cfg) != 0) {
+        return (-1);
+    }
+
     board->ready = 0;
+    board->prev_ss = 0;
+    board->prev_dsize = 0;
+    clock_gettime(CLOCK_REALTIME, &board->time_begin);
+    crcInit ();
+    board->io_run = 0;
+    board->io_stop = 0;
+    board->group = NULL;
+    board->ev_shared = 0;
+    board->ev_polled = 0;
+    board->stage_cnt = 0;
+    pthread_mutex_init (&board->stage_lock, NULL);
+    board->fifo_cnt = 0;
+    pthread_mutex_init (&board->io_lock, NULL);
+    pthread_cond_init (&board->io_cond, NULL);
 
     memset (board->wb_reg_map, 0, WB_REG_SIZE);
     // memset (board->mbox_buf, 0, (WOUF_HDR_SIZE+MAX_PSIZE+CRC_SIZE));
@@ -437,6 +558,7 @@ int board_init (board_t* board, const char* device_type, const int device_id,
             board->board_type = board_table[i].board_type;
             board->chip_type = board_table[i].chip_type;
             board->io_type = board_table[i].io_type;
+            board->xport = board_table[i].xport;
             board->program_funct = board_table[i].program_funct;
             if (board->io_type == IO_TYPE_USB) {
                 board->io.usb.usb_devnum = device_id;
@@ -455,116 +577,106 @@ int board_init (board_t* board, const char* device_type, const int device_id,
     DP ("board_type(%s)\n", board->board_type);
     DP ("chip_type(%s)\n", board->chip_type);
    
-    board->wou = (wou_t *) malloc (sizeof(wou_t));
+    wou = (wou_t *) malloc (sizeof(wou_t));
+    if (wou == NULL) {
+        ERRP ("malloc(wou_t) failed\n");
+        return (-1);
+    }
+    wou->rx_ring_size = 1;
+    while (wou->rx_ring_size < (RX_RING_CHUNKS * board->cfg.rx_chunk_size)) {
+        wou->rx_ring_size <<= 1;
+    }
+    wou->rx_ring_mask = wou->rx_ring_size - 1;
+    wou->tx_ring_size = TX_RING_SIZE(board->cfg.frames);
+    wou->woufs = (wouf_t *) calloc (board->cfg.frames, sizeof(wouf_t));
+    wou->tx_ring = (uint8_t *) malloc (wou->tx_ring_size);
+    wou->buf_rx = (uint8_t *) malloc (wou->rx_ring_size + WOUF_HDR_SIZE - 1);
+    if ((wou->woufs == NULL) || (wou->tx_ring == NULL) || (wou->buf_rx == NULL)) {
+        ERRP ("malloc() of frames(%d) rx_ring_size(%u) failed\n",
+              board->cfg.frames, wou->rx_ring_size);
+        free (wou->woufs);
+        free (wou->tx_ring);
+        free (wou->buf_rx);
+        free (wou);
+        return (-1);
+    }
+    board->wou = wou;
     board->wou->mbox_callback = NULL;
     board->wou->crc_error_callback = NULL;
     board->wou->rt_cmd_callback = NULL;
     board->wou->crc_error_counter = 0;
     board->wou->error_gen_en = 0;
+    board->wou->count_tx = 0;
+    board->wou->count_rx = 0;
+    board->wou->count_single_break = 0;
+    board->wou->count_tx_fail = 0;
+    board->wou->count_reconnect = 0;
+    board->wou->count_rx_fail = 0;
+    board->wou->arq_req = WOU_ARQ_GBN;     // ARQ_SR is opt-in, see wou_set_arq()
     // RESET TX_TIMEOUT:
-    clock_gettime(CLOCK_REALTIME, &time_send_begin);
-    clock_gettime(CLOCK_REALTIME, &time_send_success);
+    clock_gettime(CLOCK_REALTIME, &board->wou->time_send_begin);
+    clock_gettime(CLOCK_REALTIME, &board->wou->time_send_success);
     gbn_init (board);
 
-    // init CRC look-up table
-    crcInit();
-
     return 0;
 }
 
 int board_connect (board_t* board)
 {
     int ret;
-    struct ftdi_context *ftdic;
-
-    board->io.usb.rx_tc = NULL;    // init transfer_control for async-read
-    board->io.usb.tx_tc = NULL;    // init transfer_control for async-write
-    ftdic = &(board->io.usb.ftdic);
-    if (ftdi_init(ftdic) < 0)
-    {
-        ERRP("ftdi_init failed\n");
-        return EXIT_FAILURE;
-    }
-    
-    ftdic->usb_read_timeout = 1000;
-    ftdic->usb_write_timeout = 1000;
-    ftdic->writebuffer_chunksize = TX_CHUNK_SIZE;
-    if (ret = ftdi_read_data_set_chunksize(ftdic, RX_CHUNK_SIZE) < 0) {
-        ERRP("ftdi_read_data_set_chunksize(): %d (%s)\n", 
-              ret, ftdi_get_error_string(ftdic));
-        return EXIT_FAILURE;
-    }
-    
-    if ((ret = ftdi_usb_open(ftdic, 0x0403, 0x6001)) < 0)
-    {
-        ERRP("unable to open ftdi device: %d (%s)\n", ret, ftdi_get_error_string(ftdic));
-        return EXIT_FAILURE;
-    }
-    
-    if ((ret = ftdi_set_latency_timer(ftdic, 1)) < 0)
-    {
-        ERRP("ftdi_set_latency_timer(): %d (%s)\n", ret, ftdi_get_error_string(ftdic));
-        return EXIT_FAILURE;
-    }
 
-    if ((ret = ftdi_usb_reset (ftdic)) < 0)
+    if ((ret = board->xport->open (board)) != 0)
     {
-        ERRP ("ftdi_usb_reset() failed: %d", ret);
-        return EXIT_FAILURE;
-    }
-
-    if ((ret = ftdi_usb_purge_buffers (ftdic)) < 0)
-    {
-        ERRP ("ftdi_usb_purge_buffers() failed: %d", ret);
-        return EXIT_FAILURE;
-    }
-
-    // Read out FTDIChip-ID of R type chips
-    if (ftdic->type == TYPE_R)
-    {
-        unsigned int chipid;
-        ERRP ("ftdi_read_chipid: %d\n", ftdi_read_chipid(ftdic, &chipid));
-        ERRP ("FTDI chipid: %X\n", chipid);
+        return ret;
     }
     
     if (board->io.usb.bitfile) {
         board_prog(board);  // program FPGA if bitfile is provided
     }
     
-    DP ("ftdic->max_packet_size(%u)\n", ftdic->max_packet_size);
-    
     // for updating board_status:
-    clock_gettime(CLOCK_REALTIME, &time_begin);
-    clock_gettime(CLOCK_REALTIME, &time_send_begin);
-    prev_ss = 0;
+    clock_gettime(CLOCK_REALTIME, &board->time_begin);
+    clock_gettime(CLOCK_REALTIME, &board->wou->time_send_begin);
+    board->prev_ss = 0;
+    board->prev_dsize = 0;
     
     gbn_init (board);   // go_back_n
-
-
+    arq_request (board);
 
     return (0);
 }
 
 int board_close (board_t* board)
 {
-#ifdef HAVE_LIBFTD2XX
-    if (board->io.usb.ftHandle) {
-        FT_Close(board->io.usb.ftHandle);
-        board->io.usb.ftHandle = NULL;
-    }
-#else
-#ifdef HAVE_LIBFTDI
     int ret;
-    struct ftdi_context *ftdic;
-    ftdic = &(board->io.usb.ftdic);
-    if ((ret = ftdi_usb_close(ftdic)) < 0)
+    int i;
+
+    board_io_stop (board);
+    if ((ret = board->xport->close (board)) != 0)
     {
-        ERRP("unable to close ftdi device: %d (%s)\n", ret, ftdi_get_error_string(ftdic));
-        return EXIT_FAILURE;
+        return ret;
+    }
+    if (board->group) {
+        // leave the group; the backend let go of group->ctx already
+        board_group_t *g = board->group;
+        for (i = 0; i < g->n; i++) {
+            if (g->boards[i] == board) {
+                g->n --;
+                memmove (g->boards + i, g->boards + i + 1, (g->n - i) * sizeof(board_t *));
+                break;
+            }
+        }
+        board->group = NULL;
+    }
+    pthread_cond_destroy (&board->io_cond);
+    pthread_mutex_destroy (&board->io_lock);
+    for (i = 0; i < board->stage_cnt; i++) {
+        free (board->stages[i]);
     }
-    ftdi_deinit(ftdic);
-#endif  // HAVE_LIBFTDI
-#endif  // HAVE_LIBFTD2XX
+    pthread_mutex_destroy (&board->stage_lock);
+    free(board->wou->woufs);
+    free(board->wou->tx_ring);
+    free(board->wou->buf_rx);
     free(board->wou);
     return 0;
 }   
@@ -578,12 +690,8 @@ int board_close (board_t* board)
  **/
 static int m7i43u_cpld_reset(struct board *board) 
 {
-    uint8_t                 *buf_tx;
+    uint8_t                 buf_tx[6];
     int                     ret;
-    struct ftdi_context     *ftdic;
-    
-    ftdic = &(board->io.usb.ftdic);
-    buf_tx = board->wou->buf_tx;
 
     // d[0]: 4bit of 0: turn USB_ECHO off
     buf_tx[0] = 0;
@@ -594,9 +702,8 @@ static int m7i43u_cpld_reset(struct board *board)
     buf_tx[4] = 0;
     /* Write */
     buf_tx[5] = 1;
-    if ((ret = ftdi_write_data (ftdic, buf_tx, 6)) != 6)
+    if ((ret = board->xport->write (board, buf_tx, 6)) != 6)
     {
-        ERRP("ftdi_write_data: %d (%s)\n", ret, ftdi_get_error_string(ftdic));
         return -1;
     }
     return 0;
@@ -607,7 +714,6 @@ static int m7i43u_cpld_send_firmware(struct board *board, struct bitfile_chunk *
     int i;
     uint8_t *dp;
     int ret;
-    struct ftdi_context     *ftdic;
     
     dp = ch->body;
     for (i = 0; i < ch->len; i ++) {
@@ -615,14 +721,11 @@ static int m7i43u_cpld_send_firmware(struct board *board, struct bitfile_chunk *
         dp ++;
     }
     
-    ftdic = &(board->io.usb.ftdic);
     /* sync Write */
     i = 0;
     do {
-        if ((ret = ftdi_write_data(ftdic, ch->body, ch->len)) < 0)
+        if ((ret = board->xport->write (board, ch->body, ch->len)) < 0)
         {
-            ERRP("ftdi_write_data: %d (%s)\n",
-                    ret, ftdi_get_error_string(ftdic));
             i++; // error_count
             if (i > 100)
                 return -1;
@@ -659,6 +762,100 @@ static struct timespec diff(struct timespec start, struct timespec end)
 }
 
 
+// CLOCK_MONOTONIC in ns, for RTT
+static int64_t time_ns (void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((int64_t) t.tv_sec * 1000000000LL + t.tv_nsec);
+}
+
+/**
+ * rtt_sample - take the RTT of an ACKed wouf, and derive the TX TIMEOUT
+ *              from it, Jacobson/Karels style; re-sent woufs give no
+ *              sample (Karn), since the ACK may be for any of the sends
+ **/
+static void rtt_sample (wou_t *wou, int64_t rtt)
+{
+    int64_t     srtt;
+    int64_t     err;
+    int64_t     rto;
+
+    rtt = MAX(rtt, 1);
+    srtt = wou->srtt;
+    if (srtt == 0) {
+        srtt = rtt;
+        wou->rttvar = rtt / 2;
+    } else {
+        err = rtt - srtt;
+        srtt += err / 8;
+        if (err < 0) err = -err;
+        wou->rttvar += (err - wou->rttvar) / 4;
+    }
+    rto = srtt + 4 * wou->rttvar;
+    rto = MAX(rto, RTO_MIN_NSEC);
+    rto = MIN(rto, RTO_MAX_NSEC);
+    STORE_REL(&wou->srtt, srtt);
+    STORE_REL(&wou->rto, rto);
+}
+
+/**
+ * burst_adapt - once a period, resize the USB bursts within wou_config_t
+ *  TX: halve on NAKs, the FPGA dropping woufs of long bursts; shrink on
+ *      slow writes, or on a short queue, for latency; grow while the
+ *      queue is half of tx_chunk_size or more, the link being behind,
+ *      for fewer and larger writes
+ *  RX: double while reads come back full, data waiting behind them;
+ *      halve while they come back half empty, waiting for data
+ **/
+static void burst_adapt (board_t* b, int64_t now)
+{
+    wou_t           *wou;
+    burst_stat_t    *bs;
+    int64_t         latency;
+    uint64_t        queued;
+    int             tx_burst;
+    int             rx_burst;
+
+    wou = b->wou;
+    bs = &(wou->burst);
+    if ((now - bs->begin) < BURST_PERIOD_NSEC) return;
+
+    tx_burst = wou->tx_burst;
+    latency = bs->writes ? (bs->write_ns / bs->writes) : 0;
+    queued = bs->samples ? (bs->queued / bs->samples) : 0;
+    if ((bs->naks * BURST_NAK_DIV) > bs->acked) {
+        tx_burst /= 2;
+    } else if (latency > BURST_LAT_NSEC) {
+        tx_burst -= tx_burst / 4;
+    } else if ((queued * 2) >= b->cfg.tx_chunk_size) {
+        tx_burst += tx_burst / 2;
+    } else if (queued < tx_burst) {
+        tx_burst -= tx_burst / 4;
+    }
+    // tx_submit() can not wait for more than tx_chunk_size
+    tx_burst = MIN(tx_burst, MIN(b->cfg.tx_burst_max, b->cfg.tx_chunk_size));
+    tx_burst = MAX(tx_burst, b->cfg.tx_burst_min);
+
+    rx_burst = wou->rx_burst;
+    if (bs->reads && ((bs->rd_got + (bs->rd_req / 8)) >= bs->rd_req)) {
+        rx_burst *= 2;
+    } else if (bs->reads && ((bs->rd_got * 2) < bs->rd_req)) {
+        rx_burst /= 2;
+    }
+    rx_burst = MAX(rx_burst, b->cfg.rx_burst_min);
+    rx_burst = MIN(rx_burst, b->cfg.rx_chunk_size);
+
+    DP ("tx_burst(%d) rx_burst(%d) latency(%lld) queued(%llu) naks(%u/%u) rd(%llu/%llu)\n",
+        tx_burst, rx_burst, (long long) latency, (unsigned long long) queued,
+        bs->naks, bs->acked, (unsigned long long) bs->rd_got, (unsigned long long) bs->rd_req);
+    STORE_REL(&wou->tx_burst, tx_burst);
+    STORE_REL(&wou->rx_burst, rx_burst);
+    memset (bs, 0, sizeof(burst_stat_t));
+    bs->begin = now;
+}
+
 static uint8_t wb_reg_update (board_t* b, const uint8_t *buf)
 {
     uint8_t*    wb_regp;   // wb_reg_map pointer
@@ -691,6 +888,122 @@ static uint8_t wb_reg_update (board_t* b, const uint8_t *buf)
     return (dsize);
 }      
 
+/**
+ * gbn_advance - the FPGA got @advance woufs from Sb: hand them back to
+ *               wou_eof(), and move the window
+ **/
+static void gbn_advance (board_t* b, uint8_t advance)
+{
+    uint8_t *Sm;
+    uint8_t *Sb;
+    uint8_t *Sn;
+    wouf_t  *wou_frame_;
+    int64_t tx_ns;
+    int     i;
+
+    Sm = &(b->wou->Sm);
+    Sb = &(b->wou->Sb);
+    Sn = &(b->wou->Sn);
+    tx_ns = 0;
+
+    // If you receive a request number where Rn > Sb
+    // Sm = Sm + (Rn – Sb)
+    // Sb = Rn
+    for (i=0; i<advance; i++) {
+        wou_frame_ = &(b->wou->woufs[*Sb]);
+        if (LOAD_ACQ(&wou_frame_->use) == 0) break;    // stop moving window for empty TX.WOUF
+        assert(wou_frame_->buf[4] == TYP_WOUF);
+        // RTT of the last wouf ACKed, if it was sent once
+        tx_ns = wou_frame_->resent ? 0 : wou_frame_->tx_ns;
+        STORE_REL(&wou_frame_->use, 0);     // hand the slot back to wou_eof()
+
+        *Sb = *Sb + 1;
+        if (*Sb >= b->cfg.frames) {
+            *Sb -= b->cfg.frames;
+        }
+
+        DP ("Sn(%02X) - Sb(%02X) = %02X\n", *Sn, *Sb, (*Sn - *Sb) & 0xFF);
+        if (((*Sn - *Sb + b->cfg.frames) % b->cfg.frames) > b->cfg.window) *Sn = *Sb;
+
+        *Sm = *Sm + 1;
+        if (*Sm >= b->cfg.frames) {
+            *Sm -= b->cfg.frames;
+        }
+
+        DP ("Sm(0x%02X) Sn(0x%02X) Sb(0x%02X) Sb.use(%d) tidSb(0x%02X)\n", *Sm, *Sn, *Sb, b->wou->woufs[*Sb].use, b->wou->woufs[*Sb].buf[5]);
+        assert ((*Sm - *Sn) < b->cfg.window);
+        assert ((*Sn - *Sb) < b->cfg.window);
+    }
+    b->wou->burst.acked += i;
+    if (tx_ns) {
+        rtt_sample (b->wou, time_ns () - tx_ns);
+    }
+    // RESET GO-BACK-N TIMEOUT
+    clock_gettime(CLOCK_REALTIME, &b->wou->time_send_success);
+    if (b->io_run) {
+        // wake up wou_eof() waiting for a free slot
+        pthread_mutex_lock (&b->io_lock);
+        pthread_cond_broadcast (&b->io_cond);
+        pthread_mutex_unlock (&b->io_lock);
+    }
+}
+
+/**
+ * sack_parse - take a SACK_WOUF: move Sb to its TID like an ACK, then
+ *              re-send only the woufs missing before the last one held
+ *              by the FPGA; a missing wouf sent after that one may still
+ *              be on its way, and is left alone
+ **/
+static void sack_parse (board_t* b, const uint8_t *buf_head)
+{
+    wou_t       *wou;
+    wouf_t      *wou_frame_;
+    uint64_t    held;
+    uint32_t    top_seq;
+    uint8_t     advance;
+    int         sent;
+    int         top;
+    int         clk;
+    int         i;
+
+    wou = b->wou;
+    // a SACK_WOUF implies the agreement, should ARQ_SR get lost
+    STORE_REL(&wou->arq, WOU_ARQ_SR);
+
+    wou_frame_ = &(wou->woufs[wou->Sb]);
+    if (LOAD_ACQ(&wou_frame_->use) == 0) return;
+    advance = buf_head[2] - wou_frame_->buf[5];
+    if (advance > b->cfg.window) {
+        DP ("ACKED ALREADY\n");
+        return;
+    }
+    if (advance) {
+        gbn_advance (b, advance);
+        wou_frame_ = &(wou->woufs[wou->Sb]);
+        if ((LOAD_ACQ(&wou_frame_->use) == 0) || (wou_frame_->buf[5] != buf_head[2])) return;
+    }
+
+    memcpy (&held, buf_head + 3, sizeof(held));
+    sent = ((int) wou->Sn - (int) wou->Sb + b->cfg.frames) % b->cfg.frames;
+    if ((held == 0) || (sent == 0) || (wou->tx_size >= b->cfg.tx_chunk_size)) {
+        // nothing to tell, or catch up with a later SACK_WOUF
+        return;
+    }
+
+    // bit i of held[] is the wouf at Sb + 1 + i
+    top = MIN(64 - __builtin_clzll (held), sent - 1);
+    top_seq = wou->woufs[(wou->Sb + top) % b->cfg.frames].tx_seq;
+    for (i = 0; i < top; i++) {
+        if (i && ((held >> (i - 1)) & 1)) continue;
+        clk = (wou->Sb + i) % b->cfg.frames;
+        if (LOAD_ACQ(&wou->woufs[clk].use) == 0) break;
+        if ((int32_t) (wou->woufs[clk].tx_seq - top_seq) > 0) continue;
+        DP ("SACK: re-send tid(0x%02X)\n", wou->woufs[clk].buf[5]);
+        if (wouf_queue (b, clk)) break;
+        wou->burst.naks ++;
+    }
+}
+
 static int wouf_parse (board_t* b, const uint8_t *buf_head)
 {
     uint16_t tmp;
@@ -703,7 +1016,6 @@ static int wouf_parse (board_t* b, const uint8_t *buf_head)
     uint8_t tidR;           // TID from FPGA
     uint8_t advance;        // Sb advance number (woufs to be flushed)
     wouf_t  *wou_frame_;
-    int     i;
     
     // CRC pass; about to check WOUF_COMMAND type
     if (buf_head[1] == TYP_WOUF) {
@@ -715,7 +1027,7 @@ static int wouf_parse (board_t* b, const uint8_t *buf_head)
 
         wou_frame_ = &(b->wou->woufs[*Sb]);
 
-        if (wou_frame_->use == 1)
+        if (LOAD_ACQ(&wou_frame_->use) == 1)
         {
             assert(wou_frame_->buf[4] == TYP_WOUF);
             tidSb = wou_frame_->buf[5]; /* buf[5]: TID of WOUF[Sb] */
@@ -730,43 +1042,17 @@ static int wouf_parse (board_t* b, const uint8_t *buf_head)
                 // ysli: 若在這裡要求重送 *Sb ，會嚴重拖累 TX 的效能，還不清楚原因
                 //       jfifo 滿了之後，會開始 flush WOUF, 因此會產生 NAK
                 *Sn = *Sb; // force to re-transmit from Sb
+                b->wou->burst.naks ++;
                 DP ("PLOAD_SIZE_TX(%d)\n", buf_head[0]);
                 assert (buf_head[0] == 2); // {WOUF, TID} only
-//                clock_gettime(CLOCK_REALTIME, &time_send_success);
+//                clock_gettime(CLOCK_REALTIME, &b->wou->time_send_success);
                 return (0);
             }
 
             // about to update Rn
-            if (advance <= NR_OF_WIN)
+            if (advance <= b->cfg.window)
             {
-                // If you receive a request number where Rn > Sb
-                // Sm = Sm + (Rn – Sb)
-                // Sb = Rn
-                for (i=0; i<advance; i++) {
-                    wou_frame_ = &(b->wou->woufs[*Sb]);
-                    if (wou_frame_->use == 0) break;    // stop moving window for empty TX.WOUF
-                    assert(wou_frame_->buf[4] == TYP_WOUF);
-                    wou_frame_->use = 0;
-
-                    *Sb = *Sb + 1;
-                    if (*Sb >= NR_OF_CLK) {
-                        *Sb -= NR_OF_CLK;
-                    }
-
-                    DP ("Sn(%02X) - Sb(%02X) = %02X\n", *Sn, *Sb, (*Sn - *Sb) & 0xFF);
-                    if (((*Sn - *Sb) & 0xFF) > NR_OF_WIN) *Sn = *Sb;
-
-                    *Sm = *Sm + 1;
-                    if (*Sm >= NR_OF_CLK) {
-                        *Sm -= NR_OF_CLK;
-                    }
-
-                    DP ("Sm(0x%02X) Sn(0x%02X) Sb(0x%02X) Sb.use(%d) tidSb(0x%02X)\n", *Sm, *Sn, *Sb, b->wou->woufs[*Sb].use, b->wou->woufs[*Sb].buf[5]);
-                    assert ((*Sm - *Sn) < NR_OF_WIN);
-                    assert ((*Sn - *Sb) < NR_OF_WIN);
-                }
-                // RESET GO-BACK-N TIMEOUT
-                clock_gettime(CLOCK_REALTIME, &time_send_success);
+                gbn_advance (b, advance);
             } else {
                 // already acked WOUF
                 DP ("ACKED ALREADY\n");
@@ -802,6 +1088,14 @@ static int wouf_parse (board_t* b, const uint8_t *buf_head)
             b->wou->mbox_callback(buf_head);
         }
 
+        return (0);
+    } else if (buf_head[1] == ARQ_SR) {
+        // the FPGA agreed to SELECTIVE-REPEAT
+        DP ("ARQ_SR window(%d)\n", buf_head[2]);
+        STORE_REL(&b->wou->arq, WOU_ARQ_SR);
+        return (0);
+    } else if (buf_head[1] == SACK_WOUF) {
+        sack_parse (b, buf_head);
         return (0);
     } else if (buf_head[1] == RT_WOUF) {
         // about to parse [WOU][WOU]...
@@ -818,6 +1112,140 @@ static int wouf_parse (board_t* b, const uint8_t *buf_head)
     }
 } // wouf_parse()
 
+/**
+ * rx_stage - copy {PLOAD_SIZE_TX, PAYLOAD, CRC} of the frame at rx_head
+ *            out of buf_rx[] into rx_frame[], wrapped or not, and
+ *            checksum {PLOAD_SIZE_TX, PAYLOAD} on the way; each byte of
+ *            the ring is read once, and wouf_parse() writes wb_reg_map[]
+ *            from rx_frame[] only after CRC PASS
+ * returns: CRC of the @pload_size_tx + 1 bytes from PLOAD_SIZE_TX
+ **/
+static uint16_t rx_stage (wou_t *wou, int pload_size_tx)
+{
+    uint32_t    head;
+    uint16_t    crc16;
+    int         size;
+    int         seg;
+    int         i;
+
+    head = (wou->rx_head + WOUF_HDR_SIZE - 1) & wou->rx_ring_mask;
+    size = 1/*PLOAD_SIZE_TX*/ + pload_size_tx;
+    seg = MIN(size, (int) (wou->rx_ring_size - head));
+    crc16 = crcFastCopy (0, wou->rx_frame, wou->buf_rx + head, seg);
+    if (seg < size) {
+        crc16 = crcFastCopy (crc16, wou->rx_frame + seg, wou->buf_rx, size - seg);
+    }
+    for (i = 0; i < CRC_SIZE; i++) {
+        wou->rx_frame[size + i] = wou->buf_rx[(head + size + i) & wou->rx_ring_mask];
+    }
+    return (crc16);
+}
+
+/**
+ * sync_find - locate {PREAMBLE_0, PREAMBLE_1, SOFD} and non-zero PLOAD_SIZE_TX
+ *             at @n positions of @p, 16 at a time with SSE2 or NEON
+ *             reads up to p[n + 2]
+ * returns: offset of the first match, or @n if none
+ **/
+static int sync_find (const uint8_t *p, int n)
+{
+    int         i;
+
+    i = 0;
+#if defined(__SSE2__)
+    {
+        const __m128i pre = _mm_set1_epi8 (WOUF_PREAMBLE);
+        const __m128i sofd = _mm_set1_epi8 ((char) WOUF_SOFD);
+        const __m128i zero = _mm_setzero_si128 ();
+        __m128i     m;
+        int         mask;
+
+        for (; (i + 16) <= n; i += 16) {
+            m = _mm_and_si128 (_mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i *) (p + i)), pre),
+                               _mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i *) (p + i + 1)), pre));
+            m = _mm_and_si128 (m, _mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i *) (p + i + 2)), sofd));
+            m = _mm_andnot_si128 (_mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i *) (p + i + 3)), zero), m);
+            mask = _mm_movemask_epi8 (m);
+            if (mask) {
+                return (i + __builtin_ctz (mask));
+            }
+        }
+    }
+#elif defined(__ARM_NEON)
+    {
+        const uint8x16_t pre = vdupq_n_u8 (WOUF_PREAMBLE);
+        const uint8x16_t sofd = vdupq_n_u8 (WOUF_SOFD);
+        const uint8x16_t zero = vdupq_n_u8 (0);
+        uint8x16_t  m;
+        uint64_t    mask;
+
+        for (; (i + 16) <= n; i += 16) {
+            m = vandq_u8 (vceqq_u8 (vld1q_u8 (p + i), pre),
+                          vceqq_u8 (vld1q_u8 (p + i + 1), pre));
+            m = vandq_u8 (m, vceqq_u8 (vld1q_u8 (p + i + 2), sofd));
+            m = vbicq_u8 (m, vceqq_u8 (vld1q_u8 (p + i + 3), zero));
+            // a nibble per byte
+            mask = vget_lane_u64 (vreinterpret_u64_u8 (vshrn_n_u16 (vreinterpretq_u16_u8 (m), 4)), 0);
+            if (mask) {
+                return (i + (__builtin_ctzll (mask) >> 2));
+            }
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        if ((p[i] == WOUF_PREAMBLE) && (p[i + 1] == WOUF_PREAMBLE)
+            && (p[i + 2] == WOUF_SOFD) && (p[i + 3] > 0)) {
+            break;
+        }
+    }
+    return (i);
+}
+
+/**
+ * sync_scan - sync_find() for @n positions from rx_head of buf_rx[]
+ * returns: offset of the first match from rx_head, or @n if none
+ **/
+static int sync_scan (wou_t *wou, int n)
+{
+    uint32_t    head;
+    int         seg;
+    int         i;
+
+    head = wou->rx_head & wou->rx_ring_mask;
+    seg = MIN(n, (int) (wou->rx_ring_size - head));
+    if ((head + seg) == wou->rx_ring_size) {
+        // the last positions look ahead across the end of the ring
+        memcpy (wou->buf_rx + wou->rx_ring_size, wou->buf_rx, WOUF_HDR_SIZE - 1);
+    }
+    i = sync_find (wou->buf_rx + head, seg);
+    if ((i < seg) || (seg == n)) {
+        return (i);
+    }
+    return (seg + sync_find (wou->buf_rx, n - seg));
+}
+
+/**
+ * wouf_plausible - check WOUF_COMMAND and PLOAD_SIZE_TX of a candidate
+ *                  frame from the FPGA before spending a CRC on it
+ **/
+static int wouf_plausible (uint8_t pload_size_tx, uint8_t wouf_cmd)
+{
+    switch (wouf_cmd) {
+    case TYP_WOUF:
+        return (pload_size_tx >= 2);            // {WOUF_COMMAND, TID, ...}
+    case MAILBOX:
+        return ((pload_size_tx >= 7) && (pload_size_tx < 254));
+    case RT_WOUF:
+        return (1);
+    case ARQ_SR:
+        return (pload_size_tx == 2);            // {ARQ_SR, WINDOW}
+    case SACK_WOUF:
+        return (pload_size_tx == (2 + SACK_BITS / 8));
+    default:
+        return (0);
+    }
+}
+
 // receive data from USB and update corresponding WB registers
 void wou_recv (board_t* b)
 {
@@ -827,79 +1255,66 @@ void wou_recv (board_t* b)
     uint16_t    crc16;
     int         pload_size_tx;
     uint8_t     *buf_head;
-    int         *rx_size;      // size of buf_rx[]
+    int         rx_size;        // bytes in buf_rx[] to be parsed
     uint8_t     *buf_rx;
+    uint32_t    *rx_head;
+    uint32_t    rx_tail;
     enum rx_state_type *rx_state;
-    static uint8_t sync_words[3] = {WOUF_PREAMBLE, WOUF_PREAMBLE, WOUF_SOFD};
 
     int recvd;
-    struct ftdi_context     *ftdic;
-    struct timeval    poll_timeout = {0,0};
+    int rx_req;
+    const wou_transport_t *xport;
 
-    ftdic = &(b->io.usb.ftdic);
-    if (ftdic->usb_connected == 0) return;
+    xport = b->xport;
+    if (!xport->connected (b)) return;
+
+    // every poll of the link, busy or idle, runs the burst period
+    burst_adapt (b, time_ns ());
 
-    rx_size = &(b->wou->rx_size);
     buf_rx = b->wou->buf_rx;
+    rx_head = &(b->wou->rx_head);
     rx_state = &(b->wou->rx_state);
-    recvd = 0;
-    if (b->io.usb.rx_tc) {
-        // rx_tc->transfer could be NULL if (size <= ftdi->readbuffer_remaining)
-        // at ftdi_read_data_submit();
-        // assert (b->io.usb.rx_tc->transfer != NULL);
+    recvd = xport->poll (b, XFER_RX);
+    if (recvd == XFER_BUSY) {
         // there's previous pending async read
-        if (b->io.usb.rx_tc->transfer) {
-            assert (ftdic->usb_dev != NULL);
-            if (libusb_handle_events_timeout_completed(ftdic->usb_ctx, &poll_timeout, &(b->io.usb.rx_tc->completed)) < 0)
-            {
-                ERRP("libusb_handle_events_timeout_completed() (%s)\n", ftdi_get_error_string(ftdic));
-                return;
-            }
-            DP ("libusb_handle_events...\n");
-            DP ("readbuffer_remaining(%u)\n", ftdic->readbuffer_remaining);
-        }
-
-        if (b->io.usb.rx_tc->completed) {
-            recvd = ftdi_transfer_data_done (b->io.usb.rx_tc);
-
+        return;
+    } else if (recvd == XFER_IDLE) {
+        recvd = 0;
+    } else {
 #ifdef DROP_RX_DATA
-            // generate random error to drop packet:
-            if (b->wou->error_gen_en)
+        // generate random error to drop packet:
+        if (b->wou->error_gen_en)
+        {
+            if ((rand_r(&b->wou->err_seed) % 10) < 3) /* 30% error rate */
             {
-                if ((rand() % 10) < 3) /* 30% error rate */
-                {
-                    recvd = -1;
-                }
-            }
-#endif
-            if (recvd < 0) {
-                DP ("recvd(%d)\n", recvd);
-                DP ("readbuffer_remaining(%u)\n", ftdic->readbuffer_remaining);
-                recvd = 0;  // to issue another ftdi_read_data_submit()
+                recvd = 0;  // to issue another async read
             }
-            b->io.usb.rx_tc = NULL;
-        } else {
-            DP ("b->io.usb.rx_tc->completed(%d)\n", b->io.usb.rx_tc->completed);
-            return;
         }
+#endif
     }
 
-    assert(b->io.usb.rx_tc == NULL);
     DP ("recvd(%d)\n", recvd);
+    if (recvd > 0) {
+        b->wou->burst.reads ++;
+        b->wou->burst.rd_req += b->wou->rx_req_size;
+        b->wou->burst.rd_got += recvd;
+    }
     /* recvd > 0 */
-    // append data from USB to buf_rx[]
+    // the async read landed at rx_tail of buf_rx[]
     b->rd_dsize += recvd;
-    *rx_size += recvd;
+    b->wou->rx_tail += recvd;
+    rx_tail = b->wou->rx_tail;
     
     // parsing buf_rx[]:
-    buf_head = buf_rx;
+    buf_head = NULL;
     do {
-        DP ("rx_state(%d), rx_size(%d)\n", *rx_state, *rx_size);
+        rx_size = rx_tail - *rx_head;
+        DP ("rx_state(%d), rx_size(%d)\n", *rx_state, rx_size);
         immediate_state = 0;
         switch (*rx_state) {
         case SYNC:
             // locate for {PREAMBLE_0, PREAMBLE_1, SOFD}
-            if (*rx_size < (WOUF_HDR_SIZE + 2/*{WOUF_COMMAND, TID/MAIL_TAG}*/ + CRC_SIZE)) {
+            if (rx_size < (WOUF_HDR_SIZE + 2/*{WOUF_COMMAND, TID/MAIL_TAG}*/ + CRC_SIZE)) {
                 // block until receiving enough data
                 DP ("block until receiving enough data\n");
                 // return; 
@@ -907,35 +1322,32 @@ void wou_recv (board_t* b)
             }
 #if(TRACE)
             DP ("buf_rx: ");
-            for (i=0; i < *rx_size; i++) {
-              DPS ("<%.2X>", buf_rx[i]);
+            for (i=0; i < rx_size; i++) {
+              DPS ("<%.2X>", buf_rx[(*rx_head + i) & b->wou->rx_ring_mask]);
             }
             DPS ("\n");
 #endif
 
-            // locate {PREAMBLE_0, PREAMBLE_1, SOFD}
-            for (i=0; i<(*rx_size - (WOUF_HDR_SIZE + 2/*{WOUF_COMMAND, TID/MAIL_TAG}*/ + CRC_SIZE)); i++) {
-                cmp = memcmp (buf_rx + i, sync_words, 3);
-                // *(buf_rx+i+3);    // PLOAD_SIZE_TX must not be 0
-                if ((cmp == 0) && (*(buf_rx+i+3) > 0)) {
-                    // we got {PREAMBLE_0, PREAMBLE_1, SOFD}
-                    break; // break the for-loop
-                }
-            }
+            // locate {PREAMBLE_0, PREAMBLE_1, SOFD} and non-zero PLOAD_SIZE_TX
+            cmp = rx_size - (WOUF_HDR_SIZE + 2/*{WOUF_COMMAND, TID/MAIL_TAG}*/ + CRC_SIZE);
+            i = sync_scan (b->wou, cmp);
+            cmp = (i < cmp) ? 0 : -1;
 
             // flush scaned bytes
-            if (i > 0)
-            {
-                *rx_size -= i;
-                memmove (buf_rx, buf_rx + i, *rx_size);
-                DP ("after memmove(): buf_rx(%p) buf_head(%p) rx_size(%d)\n", buf_rx, buf_head, *rx_size);
-            }
+            *rx_head += i;
+            rx_size -= i;
 
-            if ((cmp == 0) && (*(buf_rx+i+3) > 0)) {
+            if (cmp == 0) {
                 // we got {PREAMBLE_0, PREAMBLE_1, SOFD} and non-zero PLOAD_SIZE_TX
-                // make buf_head point to PLOAD_SIZE_TX
-                buf_head = buf_rx + (WOUF_HDR_SIZE - 1);
-                if ((WOUF_HDR_SIZE + buf_head[0] + CRC_SIZE) <= *rx_size)
+                pload_size_tx = buf_rx[(*rx_head + WOUF_HDR_SIZE - 1) & b->wou->rx_ring_mask];
+                if (!wouf_plausible (pload_size_tx, buf_rx[(*rx_head + WOUF_HDR_SIZE) & b->wou->rx_ring_mask])) {
+                    // a SYNC word in noise; do not wait for its CRC.  No CRC
+                    // is checked, so crc_error_counter is left alone
+                    DP ("bad WOUF_COMMAND(0x%02X) pload_size_tx(%d)\n",
+                        buf_rx[(*rx_head + WOUF_HDR_SIZE) & b->wou->rx_ring_mask], pload_size_tx);
+                    *rx_head += WOUF_HDR_SIZE - 1;
+                    immediate_state = 1;
+                } else if ((WOUF_HDR_SIZE + pload_size_tx + CRC_SIZE) <= rx_size)
                 {
                     // we got enough data to check CRC
                     *rx_state = PLOAD_CRC;
@@ -950,60 +1362,49 @@ void wou_recv (board_t* b)
             break;  // rx_state == SYNC
         
         case PLOAD_CRC:
-#if(TRACE)
-            DP ("buf_head(%p)\n", buf_head);
-            DP ("buf_rx  (%p): ", buf_rx);
-            for (i=0; i < *rx_size; i++) {
-              DPS ("<%.2X>", buf_rx[i]);
-            }
-            DPS ("\n");
-#endif
-            pload_size_tx = buf_head[0];    // PLOAD_SIZE_TX
-            assert (buf_head == (buf_rx + WOUF_HDR_SIZE - 1));  // buf_head[] should start from PLOAD_SIZE_TX
-            assert ((pload_size_tx + WOUF_HDR_SIZE + CRC_SIZE) <= *rx_size); // we need enough buf_rx[] to compare CRC
+            pload_size_tx = buf_rx[(*rx_head + WOUF_HDR_SIZE - 1) & b->wou->rx_ring_mask];    // PLOAD_SIZE_TX
+            assert ((pload_size_tx + WOUF_HDR_SIZE + CRC_SIZE) <= rx_size); // we need enough buf_rx[] to compare CRC
             assert (pload_size_tx >= 1);
 
             // calc CRC for {PLOAD_SIZE_TX, TID, WOU_PACKETS}
+            // while staging them into rx_frame[]
+            crc16 = rx_stage (b->wou, pload_size_tx);
+            buf_head = b->wou->rx_frame;    // buf_head[] starts from PLOAD_SIZE_TX
 #ifdef CRC_ERR_GEN
             // generate random CRC error:
             if (b->wou->error_gen_en)
             {
-                if ((rand() % 10) < 5) /* 50% error rate */
+                if ((rand_r(&b->wou->err_seed) % 10) < 5) /* 50% error rate */
                 {
                     // create CRC error
-                    (buf_head)[0] = ~(buf_head[0]);
+                    crc16 = ~crc16;
                 }
             }
 #endif
 
-            crc16 = crcFast(buf_head, (1/*PLOAD_SIZE_TX*/ + pload_size_tx));
             cmp = memcmp(buf_head + (1/*PLOAD_SIZE_TX*/ + pload_size_tx), &crc16, CRC_SIZE);
 
             if (cmp == 0 ) {
                 DP("CRC PASS\n");
-                int consumed;
                 // about to parse WOU_FRAME
-                consumed = 0;
                 if (wouf_parse (b, buf_head)) {
                     // un-expected Rn
                     ERRP ("wou: wouf_parse() error ... \n");
                     assert (0);
                 } else {
                     // expected Rn, process wouf successfully
-                    consumed = WOUF_HDR_SIZE + pload_size_tx + CRC_SIZE;
-                    *rx_size -= (consumed);
+                    *rx_head += WOUF_HDR_SIZE + pload_size_tx + CRC_SIZE;
                 }
-                if (*rx_size) {
-                    memmove (buf_rx, (buf_rx + consumed), *rx_size);
+                if (rx_tail != *rx_head) {
                     immediate_state = 1;
                 }
 
                 // finished a WOU_FRAME
             } else {
                 DP("CRC ERROR\n");
-                // consume 1 byte, and back to SYNC state
-                *rx_size -= 1;
-                memmove (buf_rx, buf_rx + 1, *rx_size);
+                // skip the SYNC word, and back to SYNC state;
+                // no other SYNC word can start inside {PREAMBLE_1, SOFD}
+                *rx_head += WOUF_HDR_SIZE - 1;
                 immediate_state = 1;
                 b->wou->crc_error_counter ++;
                 if (b->wou->crc_error_callback) {
@@ -1022,253 +1423,338 @@ void wou_recv (board_t* b)
         } /* end of switch(rx_state) */
     } while (immediate_state);
        
-    DP ("readbuffer_remaining(%u)\n", b->io.usb.ftdic.readbuffer_remaining);
+    // the next async read must not wrap or overrun unparsed data
+    rx_size = rx_tail - *rx_head;
+    rx_req = MIN(b->wou->rx_burst + xport->rx_pending (b), b->cfg.rx_chunk_size);
+    rx_req = MIN(rx_req, (int) b->wou->rx_ring_size - rx_size);
+    rx_req = MIN(rx_req, (int) (b->wou->rx_ring_size - (rx_tail & b->wou->rx_ring_mask)));
+    b->wou->rx_req_size = rx_req;
+    DP ("rx_pending(%u)\n", xport->rx_pending (b));
+    buf_head = buf_rx + (rx_tail & b->wou->rx_ring_mask);
 #if RX_FAIL_TEST
-    count_rx_fail ++;
-    if(count_rx_fail < RX_FAIL_COUNT) {
+    b->wou->count_rx_fail ++;
+    if(b->wou->count_rx_fail < RX_FAIL_COUNT) {
         // issue async_read ...
-        if ((b->io.usb.rx_tc = 
-                ftdi_read_data_submit (
-                    ftdic,
-                    buf_rx + *rx_size,
-                    MIN(RX_BURST_MIN + ftdic->readbuffer_remaining, RX_CHUNK_SIZE))) 
-                    == NULL) 
+        if (xport->submit_rx (b, buf_head, rx_req) != 0)
         {
-            ERRP("ftdi_read_data_submit(): %s\n", ftdi_get_error_string (ftdic));
-            ERRP("rx_size(%d)\n", *rx_size);
+            ERRP("rx_size(%d)\n", rx_size);
             assert(0);
         }
     }
-    if(count_rx_fail < RX_FAIL_COUNT + RX_FAIL_NUM_IN_ROW) count_rx_fail = 0;
+    if(b->wou->count_rx_fail < RX_FAIL_COUNT + RX_FAIL_NUM_IN_ROW) b->wou->count_rx_fail = 0;
 #elif RECONNECT_TEST
-    count_reconnect ++;
+    b->wou->count_reconnect ++;
     // issue async_read ...
-    if ((count_reconnect > RECONNECT_COUNT) || (b->io.usb.rx_tc = ftdi_read_data_submit (
-                            ftdic,
-                            buf_rx + *rx_size,
-                            // ftdic->readbuffer_remaining + 1))
-                            // MAX(1, ftdic->readbuffer_remaining)))
-                            MIN(RX_BURST_MIN + ftdic->readbuffer_remaining, RX_CHUNK_SIZE))) 
-                            // MIN(RX_BURST_MIN, *rx_req)))
-                            == NULL) 
+    if ((b->wou->count_reconnect > RECONNECT_COUNT) || 
+        (xport->submit_rx (b, buf_head, rx_req) != 0))
     {
         int r;
-        count_reconnect=0;
+        b->wou->count_reconnect=0;
         board_reconnect(b);
     }
 #else
     // REGULAR OPERATION
     // issue async_read ...
-    assert ((*rx_size + MIN(RX_BURST_MIN + ftdic->readbuffer_remaining, RX_CHUNK_SIZE))
-            <
-            NR_OF_WIN*(WOUF_HDR_SIZE+1/*TID_SIZE*/+MAX_PSIZE+CRC_SIZE)
-            );
-    DP ("rx_size_req(%d)\n", MIN(RX_BURST_MIN + ftdic->readbuffer_remaining, RX_CHUNK_SIZE));
-    DP ("rx_size(%d)\n", *rx_size);
-    if ((b->io.usb.rx_tc = ftdi_read_data_submit (
-                            ftdic, 
-                            buf_rx + *rx_size, 
-                            MIN(RX_BURST_MIN + ftdic->readbuffer_remaining, RX_CHUNK_SIZE))) 
-                            == NULL) 
+    assert (rx_req > 0);
+    DP ("rx_size_req(%d)\n", rx_req);
+    DP ("rx_size(%d)\n", rx_size);
+    if (xport->submit_rx (b, buf_head, rx_req) != 0)
     {
-         ERRP("ftdi_read_data_submit(): %s\n", ftdi_get_error_string (ftdic));
-         ERRP("rx_size(%d)\n", *rx_size);
+         ERRP("rx_size(%d)\n", rx_size);
     }
-    DP ("after ftdi_read_data_submit(), rx_tc=%p\n", b->io.usb.rx_tc);
 #endif
     return;
 } // wou_recv()
 
 
-static void wou_send (board_t* b)
+/**
+ * tx_queue - queue a frame for async write, without copying it
+ *            merge it to the last segment if they are contiguous
+ * returns: 0 on success, -1 if tx_iov[] is full
+ **/
+static int tx_queue (wou_t *wou, const uint8_t *buf, int size)
 {
-//    static struct timespec  time1 = {0, 0};
-    struct timespec         time2, dt;
-    uint8_t *buf_tx;
-    uint8_t *buf_src;
-    uint8_t *Sm;
-    uint8_t *Sn;
-    int     i,j;
+    tx_iov_t    *iov;
+
+    if (wou->tx_iov_cnt) {
+        iov = &(wou->tx_iov[wou->tx_iov_cnt - 1]);
+        if ((iov->ptr + iov->size) == buf) {
+            iov->size += size;
+            wou->tx_size += size;
+            return 0;
+        }
+    }
+    if (wou->tx_iov_cnt == TX_IOV_MAX) {
+        return -1;
+    }
+    iov = &(wou->tx_iov[wou->tx_iov_cnt]);
+    iov->ptr = buf;
+    iov->size = size;
+    wou->tx_iov_cnt ++;
+    wou->tx_size += size;
+    return 0;
+}
 
-    int         dwBytesWritten;
-    int         *tx_size;
-    unsigned short status;
-    struct ftdi_context     *ftdic;
-    int ret;
+/**
+ * wouf_queue - queue woufs[@clk] for async write, and stamp its send order
+ * returns: 0 on success, -1 if tx_iov[] is full
+ **/
+static int wouf_queue (board_t* b, int clk)
+{
+    wouf_t      *wou_frame_;
 
-    ftdic = &(b->io.usb.ftdic);
-    if (ftdic->usb_connected == 0) return;
+    wou_frame_ = &(b->wou->woufs[clk]);
+    if (tx_queue (b->wou, wou_frame_->buf, wou_frame_->fsize)) {
+        return -1;
+    }
+    wou_frame_->tx_seq = b->wou->tx_seq ++;
+    if (wou_frame_->tx_ns == 0) {
+        wou_frame_->tx_ns = time_ns ();
+    } else {
+        wou_frame_->resent = 1;
+    }
+    return 0;
+}
 
-    if (b->ready == 0)
-    {
-        // bypass TX TIMEOUT when board is not configured
-        clock_gettime(CLOCK_REALTIME, &time_send_success);
-        DP ("bypass TIMEOUT checking\n");
+// drop written bytes from the head of tx_iov[]
+static void tx_consume (wou_t *wou, int written)
+{
+    tx_iov_t    *iov;
+
+    iov = &(wou->tx_iov[0]);
+    assert (wou->tx_iov_cnt > 0);
+    assert (written <= iov->size);
+    iov->ptr += written;
+    iov->size -= written;
+    wou->tx_size -= written;
+    if (iov->size == 0) {
+        wou->tx_iov_cnt --;
+        memmove (iov, iov + 1, wou->tx_iov_cnt * sizeof(tx_iov_t));
     }
-    clock_gettime(CLOCK_REALTIME, &time2);
-    dt = diff(time_send_success, time2);
-    if (dt.tv_sec > 0 || dt.tv_nsec > TX_TIMEOUT) {
-        // reset time_send_success
-        clock_gettime(CLOCK_REALTIME, &time_send_success);
-        // TODO: deal with timeout value for GO-BACK-N
-        DP ("TX TIMEOUT\n");
-        DP ("dt.sec(%lu), dt.nsec(%lu)\n", dt.tv_sec, dt.tv_nsec);
-        DP ("Sm(0x%02X) Sn(0x%02X) Sb(0x%02X)\n", b->wou->Sm, b->wou->Sn, b->wou->Sb);
+}
 
-//        // RESET TX&RX Registers
-//        if (b->io.usb.tx_tc) {
-//            // finishing pending async write
-//            if (b->io.usb.tx_tc->transfer)
-//            {
-//                DP ("cancel tx_tc(%p) transfer(%p)\n", b->io.usb.tx_tc, b->io.usb.tx_tc->transfer);
-//                DP ("tx_tc->offset(%d)\n", b->io.usb.tx_tc->offset);
-//                DP ("tx_tc->completed(%d)\n", b->io.usb.tx_tc->completed);
-//                libusb_cancel_transfer(b->io.usb.tx_tc->transfer);
-//                libusb_free_transfer(b->io.usb.tx_tc->transfer);
-//                free (b->io.usb.tx_tc);
-//                b->io.usb.tx_tc = NULL;
-//            }
-//        }
+static void tx_reset (wou_t *wou)
+{
+    wou->tx_size = 0;
+    wou->tx_iov_cnt = 0;
+    wou->tx_inflight = 0;
+    // writes still in flight no longer refer to tx_iov[]
+    wou->tx_stale = wou->tx_xfer_cnt;
+}
 
-//        if (b->io.usb.rx_tc) {
-//            if (b->io.usb.rx_tc->transfer)
-//            {
-//                struct timeval tv = {0,0};
-//                assert (ftdic->usb_dev != NULL);
-//                while ((ret = libusb_handle_events_timeout_completed(ftdic->usb_ctx, &tv, NULL)) != 0) {
-//                    ERRP("libusb_handle_events_timeout_completed(%d)\n", ret);
-//                }
-//                DP ("cancel rx_tc(%p) transfer(%p)\n", b->io.usb.rx_tc, b->io.usb.rx_tc->transfer);
-//                DP ("rx_tc->offset(%d)\n", b->io.usb.rx_tc->offset);
-//                DP ("rx_tc->completed(%d)\n", b->io.usb.rx_tc->completed);
-//                ret = libusb_cancel_transfer(b->io.usb.rx_tc->transfer);
-//                DP ("libusb_cancel_transfer: %d\n", ret);
-//                libusb_free_transfer(b->io.usb.rx_tc->transfer);
-//                DP ("libusb_free_transfer\n");
-//                free (b->io.usb.rx_tc);
-//                b->io.usb.rx_tc = NULL;
-////                assert (ret != -5);
-//            }
-//        }
-        {
-            struct timeval tv = {0,0};
-            assert (ftdic->usb_dev != NULL);
-            while ((ret = libusb_handle_events_timeout_completed(ftdic->usb_ctx, &tv, NULL)) != 0) {
-                ERRP("libusb_handle_events_timeout_completed(%d)\n", ret);
-            }
+/**
+ * tx_collect - handle completed async writes, oldest first
+ **/
+static void tx_collect (board_t* b)
+{
+    wou_t       *wou;
+    int         dwBytesWritten;
+    int         size;
+#if (TRACE != 0)
+    struct timespec time2, dt;
+#endif
+
+    wou = b->wou;
+    while (wou->tx_xfer_cnt) {
+        dwBytesWritten = b->xport->poll (b, XFER_TX);
+        if (dwBytesWritten == XFER_BUSY) {
+            // the oldest async write is still pending
+            break;
         }
-        DP("TODO: figure out how to flush data from rx-fifo\n");
-//        // to clear tx and rx queue
-//        if ((ret = ftdi_usb_purge_buffers (ftdic)) < 0)
-//        {
-//            ERRP ("ftdi_usb_purge_buffers() failed: %d", ret);
-//            return;
-//        }
-//
-//        // to flush rx queue
-//        while (ret = ftdi_read_data (ftdic, b->wou->buf_rx, 1) > 0) {
-//            ERRP ("flush %d byte\n", ret);
-//            if (ftdic->readbuffer_remaining) {
-//                ERRP ("flush %u byte\n", ftdic->readbuffer_remaining);
-//                ftdi_read_data (ftdic,
-//                                  b->wou->buf_rx,
-//                                  ftdic->readbuffer_remaining);
-//            }
-//        }
+        assert (dwBytesWritten >= 0);
+
+        size = wou->tx_xfer[0];
+        wou->burst.writes ++;
+        wou->burst.write_ns += time_ns () - wou->tx_xfer_ns[0];
+        wou->tx_xfer_cnt --;
+        memmove (wou->tx_xfer, wou->tx_xfer + 1, wou->tx_xfer_cnt * sizeof(int));
+        memmove (wou->tx_xfer_ns, wou->tx_xfer_ns + 1, wou->tx_xfer_cnt * sizeof(int64_t));
+        assert (dwBytesWritten <= size);
+        b->wr_dsize += dwBytesWritten;
+
+        if (dwBytesWritten > 0) {
+            // a successful write
+#if (TRACE != 0)
+            clock_gettime(CLOCK_REALTIME, &time2);
+            dt = diff(b->wou->time_send_begin, time2);
+            DP ("tx_size(%d), dwBytesWritten(%d,0x%08X), dt.sec(%lu), dt.nsec(%lu)\n",
+                 wou->tx_size, dwBytesWritten, dwBytesWritten, dt.tv_sec, dt.tv_nsec);
+#endif
+        }
+
+        if (wou->tx_stale) {
+            // skip updating tx_iov[] after TIMEOUT
+            wou->tx_stale --;
+            continue;
+        }
+
+        wou->tx_inflight -= size;
+        if ((dwBytesWritten < size) && (wou->tx_xfer_cnt == 0)) {
+            // nothing behind it is in flight; re-send the rest
+            tx_consume (wou, dwBytesWritten);
+        } else {
+            // a short write in the middle of the pipe is a lost frame
+            // to GO-BACK-N, which re-transmits it from Sb
+            tx_consume (wou, size);
+        }
+    }
+}
 
-        if (ftdic->readbuffer_remaining)
+/**
+ * tx_submit - keep up to TX_XFER_DEPTH async writes in flight; an idle
+ *             link takes whatever is queued, and behind writes in flight,
+ *             the queue waits for tx_burst bytes
+ **/
+static void tx_submit (board_t* b)
+{
+    wou_t       *wou;
+    const tx_iov_t *iov;
+    int64_t     submit_ns;
+    int         offset;
+    int         size;
+
+    wou = b->wou;
+    while ((wou->tx_xfer_cnt < TX_XFER_DEPTH)
+           && (wou->tx_size > wou->tx_inflight))
+    {
+        if (wou->tx_xfer_cnt && ((wou->tx_size - wou->tx_inflight) < wou->tx_burst)) {
+            break;
+        }
+
+        // locate the first byte not submitted yet
+        iov = wou->tx_iov;
+        offset = wou->tx_inflight;
+        while (offset >= iov->size) {
+            offset -= iov->size;
+            iov ++;
+        }
+        size = MIN(iov->size - offset, b->cfg.tx_burst_max);
+
+        // issue async_write straight from tx_ring[] ...
+        submit_ns = time_ns ();
+        if (b->xport->submit_tx (b, iov->ptr + offset, size) != 0) {
+            break;
+        }
+        clock_gettime(CLOCK_REALTIME, &b->wou->time_send_begin);
+        wou->tx_xfer[wou->tx_xfer_cnt] = size;
+        wou->tx_xfer_ns[wou->tx_xfer_cnt] = submit_ns;
+        wou->tx_xfer_cnt ++;
+        wou->tx_inflight += size;
+
+#if (TRACE)
         {
-            DP ("flush %u byte\n", ftdic->readbuffer_remaining);
-            ftdi_read_data (ftdic,
-                              b->wou->buf_rx,
-                              ftdic->readbuffer_remaining);
+            int i;
+            DP ("buf_tx: tx_size(%d), sent(%d)", wou->tx_size, size);
+            for (i=0; i<size; i++) {
+              DPS ("<%.2X>", iov->ptr[offset + i]);
+            }
+            DPS ("\n");
         }
+#endif
+    }
+    wou->burst.queued += wou->tx_size;
+    wou->burst.samples ++;
+}
+
+static void wou_send (board_t* b)
+{
+//    static struct timespec  time1 = {0, 0};
+    struct timespec         time2, dt;
+    int64_t poll_ns;
+    uint8_t *Sm;
+    uint8_t *Sn;
+    int     i,j;
+
+    int         *tx_size;
+    unsigned short status;
+    const wou_transport_t *xport;
+
+    xport = b->xport;
+    if (!xport->connected (b)) return;
+
+    if (b->ready == 0)
+    {
+        // bypass TX TIMEOUT when board is not configured
+        clock_gettime(CLOCK_REALTIME, &b->wou->time_send_success);
+        DP ("bypass TIMEOUT checking\n");
+    }
+    clock_gettime(CLOCK_REALTIME, &time2);
+    if (b->wou->Sn == b->wou->Sb) {
+        // nothing in flight; the timer starts with the next wouf sent
+        b->wou->time_send_success = time2;
+    }
+    // an ACK in time is seen one poll late at most; should the host
+    // stall, the link is not to blame for it
+    dt = diff(b->wou->tx_poll, time2);
+    b->wou->tx_poll = time2;
+    poll_ns = dt.tv_sec * 1000000000LL + dt.tv_nsec;
+    dt = diff(b->wou->time_send_success, time2);
+    if ((dt.tv_sec * 1000000000LL + dt.tv_nsec) > (b->wou->rto + poll_ns)) {
+        // reset time_send_success
+        b->wou->time_send_success = time2;
+        // back off until an RTT sample of a wouf sent once
+        STORE_REL(&b->wou->rto, MIN(2 * b->wou->rto, RTO_MAX_NSEC));
+        b->wou->burst.naks ++;
+        DP ("TX TIMEOUT\n");
+        DP ("dt.sec(%lu), dt.nsec(%lu)\n", dt.tv_sec, dt.tv_nsec);
+        DP ("Sm(0x%02X) Sn(0x%02X) Sb(0x%02X)\n", b->wou->Sm, b->wou->Sn, b->wou->Sb);
+
+        // drop pending RX data, and then re-transmit from Sb
+        xport->reset (b, 0);
 
         DP("rx_state(%d)\n", b->wou->rx_state);
-        assert (b->wou->rx_state == SYNC);
-        b->wou->rx_size = 0;
-        b->wou->tx_size = 0;
+        // a partial frame went with the RX data; hunt for PREAMBLE again
+        b->wou->rx_state = SYNC;
+        b->wou->rx_head = b->wou->rx_tail;
+        tx_reset (b->wou);
         b->wou->Sn = b->wou->Sb;
         DP ("RESET Sm(0x%02X) Sn(0x%02X) Sb(0x%02X)\n", b->wou->Sm, b->wou->Sn, b->wou->Sb);
+
+        // no answer to ARQ_SR yet; it might be lost
+        if ((b->wou->arq_req == WOU_ARQ_SR) && (b->wou->arq == WOU_ARQ_GBN)
+            && (b->wou->arq_tries > 0) && (b->wou->arq_tries < ARQ_SR_TRIES)) {
+            b->wou->arq_pending = 1;
+        }
      }
 
 
-//async write:
-    dwBytesWritten = 0;
-    if (b->io.usb.tx_tc) {
-        // there's previous pending async write
-        if (b->io.usb.tx_tc->transfer) {
-            struct timeval poll_timeout = {0,0};
-            assert (ftdic->usb_dev != NULL);
-            if (libusb_handle_events_timeout_completed(ftdic->usb_ctx, &poll_timeout, &(b->io.usb.tx_tc->completed)) < 0) {
-                ERRP("libusb_handle_events_timeout_completed() (%s)\n", ftdi_get_error_string(ftdic));
-                return;
-            }
-        }
-        if (b->io.usb.tx_tc->completed) {
-            dwBytesWritten = ftdi_transfer_data_done (b->io.usb.tx_tc);
-            if (dwBytesWritten <= 0)
-            {
-                ERRP("dwBytesWritten(%d): (%s)\n", dwBytesWritten, ftdi_get_error_string(ftdic));
-                dwBytesWritten = 0;  // to issue another ftdi_write_data_submit()
-            }
-            else
-            {
-                // a successful write
-                clock_gettime(CLOCK_REALTIME, &time_send_success);
-#if (TRACE != 0)
-                // a successful write
-                tx_size = &(b->wou->tx_size);
-                clock_gettime(CLOCK_REALTIME, &time2);
-                dt = diff(time_send_begin, time2);
-                DP ("tx_size(%d), dwBytesWritten(%d,0x%08X), dt.sec(%lu), dt.nsec(%lu)\n",
-                     *tx_size, dwBytesWritten, dwBytesWritten, dt.tv_sec, dt.tv_nsec);
-                DP ("bitrate(%f Mbps)\n",
-                     8.0*dwBytesWritten/(1000000.0*dt.tv_sec+dt.tv_nsec/1000.0));
-#endif
-            }
-            b->io.usb.tx_tc = NULL;
-        } else {
-            DP ("tx_tc->completed(%d)\n", b->io.usb.tx_tc->completed);
-            return;
-        }
-    }
+// async write:
+    tx_collect (b);
 
-    assert(b->io.usb.tx_tc == NULL);
+    if (b->wou->arq_pending && (tx_queue (b->wou, b->wou->arq_buf, WOUF_HDR_SIZE + 2 + CRC_SIZE) == 0)) {
+        b->wou->arq_pending = 0;
+        b->wou->arq_tries ++;
+    }
 
     tx_size = &(b->wou->tx_size);
-    buf_tx = b->wou->buf_tx;
     Sm = &(b->wou->Sm);
     Sn = &(b->wou->Sn);
     DP ("Sm(0x%02X) Sn(0x%02X) Sb(0x%02X) use(%d) clock(%d)\n", 
         *Sm, *Sn, b->wou->Sb, b->wou->woufs[*Sn].use, b->wou->clock);
 
-    // skip updating dwBytesWritten after TIMEOUT
-    if (*tx_size == 0)
-        dwBytesWritten = 0;
-
     // 避免 buf_tx 爆掉，只有在 tx_size 小於 TX_CHUNK_SIZE 時，才發送新的 WOUF：
-    if (*tx_size >= TX_CHUNK_SIZE)
+    if (*tx_size >= b->cfg.tx_chunk_size)
         DP ("tx_size(%d), skip appending WOUFs\n", *tx_size);
 
-    if (*tx_size < TX_CHUNK_SIZE)
+    if (*tx_size < b->cfg.tx_chunk_size)
     {
         if (*Sm >= *Sn) {
-            if ((*Sm - *Sn) >= NR_OF_WIN) {
+            if ((*Sm - *Sn) >= b->cfg.window) {
                 // case: Sm(255), Sn(0): Sn is behind Sm
                 // stop sending when exceening Max Window Boundary
                 DP("hit Window Boundary\n");
             } else {
                 for (i=*Sn; i<=*Sm; i++) {
-                    assert (i < NR_OF_CLK);
-                    if (b->wou->woufs[i].use == 0) break;
-                    buf_src = b->wou->woufs[i].buf;
-                    memcpy (buf_tx + *tx_size, buf_src, b->wou->woufs[i].fsize);
-                    *tx_size += b->wou->woufs[i].fsize;
+                    assert (i < b->cfg.frames);
+                    if (LOAD_ACQ(&b->wou->woufs[i].use) == 0) break;
+                    if (wouf_queue (b, i)) break;
                     DP ("Sn(0x%02X) tidSn(0x%02X) size(%d) tx_size(%d)\n", *Sn, b->wou->woufs[i].buf[5], b->wou->woufs[i].fsize, *tx_size);
                     if (b->ready) assert (b->wou->woufs[i].buf[4] != RST_TID);
                     *Sn += 1;
                 }
+                if (*Sn == b->cfg.frames) {
+                    *Sn = 0;    // Sm was the last wouf
+                }
             }
         } else {
             if ((*Sn - *Sm) == 1) {
@@ -1276,26 +1762,22 @@ static void wou_send (board_t* b)
                 DP("hit Window Boundary\n");
             } else {
                 // round a circle
-                assert ((NR_OF_CLK - *Sn) <= NR_OF_WIN);
-                assert (*Sm <= (NR_OF_WIN - (NR_OF_CLK - *Sn)));
-                for (i=*Sn; i<NR_OF_CLK; i++) {
-                    assert (i < NR_OF_CLK);
-                    if (b->wou->woufs[i].use == 0) break;
-                    buf_src = b->wou->woufs[i].buf;
-                    memcpy (buf_tx + *tx_size, buf_src, b->wou->woufs[i].fsize);
-                    *tx_size += b->wou->woufs[i].fsize;
+                assert ((b->cfg.frames - *Sn) <= b->cfg.window);
+                assert (*Sm <= (b->cfg.window - (b->cfg.frames - *Sn)));
+                for (i=*Sn; i<b->cfg.frames; i++) {
+                    assert (i < b->cfg.frames);
+                    if (LOAD_ACQ(&b->wou->woufs[i].use) == 0) break;
+                    if (wouf_queue (b, i)) break;
                     DP ("Sn(0x%02X) tidSn(0x%02X) size(%d) tx_size(%d)\n", *Sn, b->wou->woufs[i].buf[5], b->wou->woufs[i].fsize, *tx_size);
                     if (b->ready) assert (b->wou->woufs[i].buf[4] != RST_TID);
                     *Sn += 1;
                 }
-                if (*Sn == (NR_OF_CLK & 0xFF)) {
+                if (*Sn == b->cfg.frames) {
                     *Sn = 0;
                     for (i=0; i<=*Sm; i++) {
-                        assert (i < NR_OF_CLK);
-                        if (b->wou->woufs[i].use == 0) break;
-                        buf_src = b->wou->woufs[i].buf;
-                        memcpy (buf_tx + *tx_size, buf_src, b->wou->woufs[i].fsize);
-                        *tx_size += b->wou->woufs[i].fsize;
+                        assert (i < b->cfg.frames);
+                        if (LOAD_ACQ(&b->wou->woufs[i].use) == 0) break;
+                        if (wouf_queue (b, i)) break;
                         DP ("Sn(0x%02X) tidSn(0x%02X) size(%d) tx_size(%d)\n", *Sn, b->wou->woufs[i].buf[5], b->wou->woufs[i].fsize, *tx_size);
                         if (b->ready) assert (b->wou->woufs[i].buf[4] != RST_TID);
                         *Sn += 1;
@@ -1308,246 +1790,228 @@ static void wou_send (board_t* b)
     DP ("Sm(%02X) tidSm(%02X) Sb(%02X) tidSb(%02X) Sn(%02X) Sn.use(%02X) clock(%02X)\n",
           *Sm, b->wou->woufs[*Sm].buf[5], b->wou->Sb, b->wou->woufs[b->wou->Sb].buf[5],
           *Sn,  b->wou->woufs[*Sn].use, b->wou->clock);
-    DP ("tx_size(%d) dwBytesWritten(%d)\n", *tx_size, dwBytesWritten);
-    assert (*tx_size < NR_OF_WIN*(WOUF_HDR_SIZE+2+MAX_PSIZE+CRC_SIZE));
-    assert (dwBytesWritten >= 0);
-
-    if (dwBytesWritten) {
-        assert (dwBytesWritten <= *tx_size);
-        b->wr_dsize += dwBytesWritten;
-        *tx_size -= dwBytesWritten;
-        memmove(buf_tx, buf_tx+dwBytesWritten, *tx_size);
-    }
-    
-    if (*tx_size < TX_BURST_MIN) {
-        DP ("skip wou_send(), tx_size(%d)\n", *tx_size);
-        return;
-    }
+    DP ("tx_size(%d) tx_inflight(%d)\n", *tx_size, b->wou->tx_inflight);
+    assert (*tx_size < b->cfg.window*(WOUF_HDR_SIZE+2+MAX_PSIZE+CRC_SIZE));
 
-    // issue async_write ...
-    b->io.usb.tx_tc = ftdi_write_data_submit (
-                            ftdic, 
-                            buf_tx, 
-                            MIN(*tx_size, TX_BURST_MAX)
-                      );
-    if (b->io.usb.tx_tc == NULL)
-    {
-        ERRP("ftdi_write_data_submit()\n");
-    }
-    else
-    {
-        clock_gettime(CLOCK_REALTIME, &time_send_begin);
-    }
-
-    // request for rx
-#if (TRACE)
-//    DP ("tx_size(%d) write_size_req(%d)\n", *tx_size, MIN(*tx_size, TX_BURST_MAX));
-    DP ("tx_size(%d) write_size_req(%d)\n", *tx_size, *tx_size);
-    if (b->io.usb.tx_tc) {
-        DP("tx_tc.completed(%d)\n", b->io.usb.tx_tc->completed);
-        if (b->io.usb.tx_tc->transfer) {
-            DP("tx_tc->transfer->status(%d)\n", b->io.usb.tx_tc->transfer->status);
-            DP("tx_tc->transfer->actual_length(%d)\n", b->io.usb.tx_tc->transfer->actual_length);
-        }
-    }
-
-//    DP ("buf_tx: tx_size(%d), sent(%d)", *tx_size, MIN(*tx_size, TX_BURST_MAX));
-    DP ("buf_tx: tx_size(%d), sent(%d)", *tx_size, *tx_size);
-    // for (i=0; ((i<*tx_size) && (i<50)) ; i++)
-    for (i=0; i<*tx_size; i++) {
-      DPS ("<%.2X>", buf_tx[i]);
-    }
-    DPS ("\n");
-#endif
-    
+    tx_submit (b);
     return;
 }
 
-static void rt_wou_send (board_t* b)
+/**
+ * rt_tx_queue - queue a finished rt_wouf for async write
+ * returns 0 if queued; otherwise the frame is dropped
+ **/
+static int rt_tx_queue (board_t* b, const uint8_t *buf, int fsize)
 {
-    struct timespec         time2, dt;
-    uint8_t *buf_tx;
-    uint8_t *buf_src;
-    uint8_t *Sm;
-    uint8_t *Sn;
-    int     i,j;
-
-    int         dwBytesWritten;
-    int         *tx_size;
-    unsigned short status;
-    struct ftdi_context     *ftdic;
+    int     *tx_size;
+    int     ret;
 
-    ftdic = &(b->io.usb.ftdic);
-
-    // there might be pended async write data
     tx_size = &(b->wou->tx_size);
-    buf_tx = b->wou->buf_tx;
-
-    //async write:
-    if (b->io.usb.tx_tc) {
-        // there's previous pending async write
-        if (b->io.usb.tx_tc->transfer) {
-            struct timeval poll_timeout = {0,0};
-            assert (ftdic->usb_dev != NULL);
-            if (libusb_handle_events_timeout_completed(ftdic->usb_ctx, &poll_timeout, &(b->io.usb.tx_tc->completed)) < 0) {
-                ERRP("libusb_handle_events_timeout() (%s)\n", ftdi_get_error_string(ftdic));
-                return;
-            }
-        }
-        if (b->io.usb.tx_tc->completed) {
-            dwBytesWritten = ftdi_transfer_data_done (b->io.usb.tx_tc);
-            if (dwBytesWritten <= 0)
-            {
-                ERRP("dwBytesWritten(%d) (%s)\n", dwBytesWritten, ftdi_get_error_string(ftdic));
-                dwBytesWritten = 0;  // to issue another ftdi_write_data_submit()
-            } 
-            else
-            {
-                // a successful write
-                clock_gettime(CLOCK_REALTIME, &time_send_success);
-#if (TRACE != 0)
-                clock_gettime(CLOCK_REALTIME, &time2);
-                dt = diff(time_send_begin, time2);
-                DP ("tx_size(%d), dwBytesWritten(%d,0x%08X), dt.sec(%lu), dt.nsec(%lu)\n",
-                     *tx_size, dwBytesWritten, dwBytesWritten, dt.tv_sec, dt.tv_nsec);
-                DP ("bitrate(%f Mbps)\n",
-                     8.0*dwBytesWritten/(1000000.0*dt.tv_sec+dt.tv_nsec/1000.0));
-#endif
-            }
-            b->io.usb.tx_tc = NULL;
-        } else {
-           return;
-        }
-    } else {
-        dwBytesWritten = 0;
-    }
+    ret = -1;
 
-    assert(b->io.usb.tx_tc == NULL);
-    
     // 避免 buf_tx 爆掉，只有在 tx_size 小於 TX_CHUNK_SIZE 時，才發送新的 WOUF：
-    if (*tx_size >= TX_CHUNK_SIZE) ERRP ("tx_size(%d), skip appending WOUFs\n", *tx_size);
+    if (*tx_size >= b->cfg.tx_chunk_size) ERRP ("tx_size(%d), skip appending WOUFs\n", *tx_size);
 
-    if (*tx_size < TX_CHUNK_SIZE)
+    if (*tx_size < b->cfg.tx_chunk_size)
     {
         /**
          * rt_wouf 只有一個 WOU_FRAME
          * 當 (*tx_size + rt_wouf) 小於一個 MAX_WOU_FRAME size 時，
          * 才傳送 RT_WOUF, 否則就將 RT_WOUF 丟掉
          **/
-        if ((*tx_size + b->wou->rt_wouf.fsize) < WOUF_HDR_SIZE+MAX_PSIZE+CRC_SIZE) {
-            buf_src = b->wou->rt_wouf.buf;
-            memcpy (buf_tx + *tx_size, buf_src, b->wou->rt_wouf.fsize);
-            *tx_size += b->wou->rt_wouf.fsize;
-            ERRP ("tx_size(%d) rt_wouf.fsize(%d)\n", tx_size, b->wou->rt_wouf.fsize);
+        if ((*tx_size + fsize) < WOUF_HDR_SIZE+MAX_PSIZE+CRC_SIZE) {
+            ret = tx_queue (b->wou, buf, fsize);
+            ERRP ("tx_size(%d) rt_wouf.fsize(%d)\n", *tx_size, fsize);
         }
     }
-    assert (*tx_size < NR_OF_WIN*(WOUF_HDR_SIZE+2+MAX_PSIZE+CRC_SIZE));
+    return ret;
+}
 
-    if (dwBytesWritten) {
-        assert (dwBytesWritten <= *tx_size);
-        b->wr_dsize += dwBytesWritten;
-        *tx_size -= dwBytesWritten;
-        memmove(buf_tx, buf_tx+dwBytesWritten, *tx_size);
+static void rt_wou_send (board_t* b)
+{
+    uint8_t *buf_src;
+
+    //async write:
+    tx_collect (b);
+
+    buf_src = b->wou->rt_wouf.buf;
+    if (rt_tx_queue (b, buf_src, b->wou->rt_wouf.fsize) == 0) {
+        // keep it in rt_ring[] until written
+        b->wou->rt_head = (buf_src - b->wou->rt_ring) + b->wou->rt_wouf.fsize;
     }
-    
-    if (*tx_size < TX_BURST_MIN) {
-        DP ("skip rt_wou_send(), tx_size(%d)\n", *tx_size);
-        return;
+    assert (b->wou->tx_size < b->cfg.window*(WOUF_HDR_SIZE+2+MAX_PSIZE+CRC_SIZE));
+
+    tx_submit (b);
+    return;
+}
+
+/**
+ * next_5_wouf - the wouf which must be empty before closing woufs[clock]
+ **/
+static wouf_t *next_5_wouf (board_t* b)
+{
+    int         next_5_clock;
+
+    next_5_clock = (int) (b->wou->clock + 5);
+    if (next_5_clock >= b->cfg.frames) {
+        next_5_clock -= b->cfg.frames;
     }
+    return (&(b->wou->woufs[next_5_clock]));
+}
 
-    // issue async_write ...
-    b->io.usb.tx_tc = ftdi_write_data_submit (
-                            ftdic, 
-                            buf_tx,
-                            MIN(*tx_size, TX_BURST_MAX)
-                            );
-    if (b->io.usb.tx_tc == NULL) {
-        ERRP("ftdi_write_data_submit()\n");
-    } else {
-    	clock_gettime(CLOCK_REALTIME, &time_send_begin);
+/**
+ * wouf_crc - bring the CRC of [WOU] packets up to fsize, once at least
+ *            @min bytes are pending, so that crcFast() gets long runs
+ **/
+static void wouf_crc (wouf_t *wou_frame_, int min)
+{
+    int pending;
+
+    pending = wou_frame_->fsize - wou_frame_->crc_end;
+    if ((pending > 0) && (pending >= min)) {
+        wou_frame_->crc = crcFastUpdate (wou_frame_->crc,
+                                         wou_frame_->buf + wou_frame_->crc_end,
+                                         pending);
+        wou_frame_->crc_end = wou_frame_->fsize;
     }
-    return;
 }
 
-int wou_eof (board_t* b, uint8_t wouf_cmd)
+/**
+ * wouf_copy - copy @dsize bytes of WB_WR_CMD data to buf[@i] of the frame
+ *             a run of WOUF_CRC_CHUNK bytes or more is checksummed in
+ *             the same pass; the rest is left to wouf_crc()
+ **/
+static void wouf_copy (wouf_t *wou_frame_, int i, const uint8_t *buf, int dsize)
+{
+    if (dsize < WOUF_CRC_CHUNK) {
+        memcpy (wou_frame_->buf + i, buf, dsize);
+        return;
+    }
+    // the CRC has to reach buf[@i] first: the [WOU] header, and
+    // small packets before it
+    wou_frame_->fsize = i;
+    wouf_crc (wou_frame_, 0);
+    wou_frame_->crc = crcFastCopy (wou_frame_->crc, wou_frame_->buf + i, buf, dsize);
+    wou_frame_->crc_end = i + dsize;
+}
+
+/**
+ * wouf_publish - close woufs[clock] and hand it over to GO-BACK-N
+ * returns 0 on success, -1 if the window has no empty wouf;
+ *         the wouf is kept for the next try then
+ **/
+static int wouf_publish (board_t* b, uint8_t wouf_cmd)
 {
     // took from vip/ftdi/generator.cpp::send_frame()
-    int         cur_clock;
     wouf_t      *wou_frame_;
     uint16_t    crc16;
-    int         next_5_clock;
-    wouf_t      *next_5_wouf_;
-    uint32_t    idle_cnt;
 
-    cur_clock = (int) b->wou->clock;
-    wou_frame_ = &(b->wou->woufs[cur_clock]);
-    
-    next_5_clock = (int) (b->wou->clock + 5);
-    if (next_5_clock >= NR_OF_CLK) {
-        next_5_clock -= NR_OF_CLK;
-    }
-    next_5_wouf_ = &(b->wou->woufs[next_5_clock]);
-
-    if (next_5_wouf_->use == 0) { 
-        assert (wou_frame_->use == 0);  // currnt wouf must be empty to write to
-        assert ((wou_frame_->fsize - WOUF_HDR_SIZE) <= MAX_PSIZE);
-        // update PAYLOAD size TX/RX of WOU_FRAME 
-        // PLOAD_SIZE_TX is part of the header
-        wou_frame_->buf[3] = 0xFF & (wou_frame_->fsize - WOUF_HDR_SIZE);
-        wou_frame_->buf[4] = wouf_cmd;
-        wou_frame_->buf[5] = b->wou->tid;
-        wou_frame_->buf[6] = 0xFF & (wou_frame_->pload_size_rx);
-        if (b->ready)
-        {
-            assert (wouf_cmd != RST_TID);
-        }
+    if (LOAD_ACQ(&next_5_wouf (b)->use)) {
+        return -1;
+    }
 
-        assert(wou_frame_->buf[3] > 2); // PLOAD_SIZE_TX: 0x03 ~ 0xFF
-        assert(wou_frame_->buf[6] > 1); // PLOAD_SIZE_RX: 0x02 ~ 0xFF
-        DP ("clock(%02X) tidClk(%02X)\n", b->wou->clock, b->wou->tid);
-        // calc CRC for {PLOAD_SIZE_TX, PLOAD_SIZE_RX, TID, WOU_PACKETS}
-        crc16 = crcFast(wou_frame_->buf + (WOUF_HDR_SIZE - 1), 
-                        wou_frame_->fsize - (WOUF_HDR_SIZE - 1)); 
-        memcpy (wou_frame_->buf + wou_frame_->fsize, &crc16, CRC_SIZE);
-        wou_frame_->fsize += CRC_SIZE;
-
-        // set use flag for CLOCK algorithm
-        wou_frame_->use = 1;    
-
-        // update the clock pointer
-        b->wou->clock += 1;
-        if (b->wou->clock == NR_OF_CLK) {
-            b->wou->clock = 0;  // clock: 0 ~ (NR_OF_CLK-1)
-        }
-        wou_frame_ = &(b->wou->woufs[b->wou->clock]);
+    wou_frame_ = &(b->wou->woufs[b->wou->clock]);
+    assert (wou_frame_->use == 0);  // currnt wouf must be empty to write to
+    assert ((wou_frame_->fsize - WOUF_HDR_SIZE) <= MAX_PSIZE);
+    // update PAYLOAD size TX/RX of WOU_FRAME 
+    // PLOAD_SIZE_TX is part of the header
+    wou_frame_->buf[3] = 0xFF & (wou_frame_->fsize - WOUF_HDR_SIZE);
+    wou_frame_->buf[4] = wouf_cmd;
+    wou_frame_->buf[5] = b->wou->tid;
+    wou_frame_->buf[6] = 0xFF & (wou_frame_->pload_size_rx);
+    if (b->ready)
+    {
+        assert (wouf_cmd != RST_TID);
+    }
 
-        next_5_clock = (int) (b->wou->clock + 5);
-        if (next_5_clock >= NR_OF_CLK) {
-            next_5_clock -= NR_OF_CLK;
-        }
-        next_5_wouf_ = &(b->wou->woufs[next_5_clock]);
+    assert(wou_frame_->buf[3] > 2); // PLOAD_SIZE_TX: 0x03 ~ 0xFF
+    assert(wou_frame_->buf[6] > 1); // PLOAD_SIZE_RX: 0x02 ~ 0xFF
+    DP ("clock(%02X) tidClk(%02X)\n", b->wou->clock, b->wou->tid);
+    // calc CRC for {PLOAD_SIZE_TX, PLOAD_SIZE_RX, TID, WOU_PACKETS}:
+    // patch the header in front of the CRC of WOU_PACKETS
+    wouf_crc (wou_frame_, 0);
+    crc16 = crcCombine(crcFast(wou_frame_->buf + (WOUF_HDR_SIZE - 1), 4),
+                       wou_frame_->crc, wou_frame_->fsize - 7);
+    memcpy (wou_frame_->buf + wou_frame_->fsize, &crc16, CRC_SIZE);
+    wou_frame_->fsize += CRC_SIZE;
+
+    // the next wouf goes right after this one in tx_ring[]
+    b->wou->tx_head = (wou_frame_->buf - b->wou->tx_ring) + wou_frame_->fsize;
+
+    // not sent yet
+    wou_frame_->tx_ns = 0;
+    wou_frame_->resent = 0;
+
+    // set use flag for CLOCK algorithm; this publishes the frame
+    STORE_REL(&wou_frame_->use, 1);
+
+    // update the clock pointer
+    b->wou->clock += 1;
+    if (b->wou->clock == b->cfg.frames) {
+        b->wou->clock = 0;  // clock: 0 ~ (frames-1)
     }
-    // flush pending [wou] packets
 
-    if (b->wou->rt_cmd_callback) {
-        b->wou->rt_cmd_callback();
+    // init the wouf buffer and tid
+    b->wou->tid += 1;   // tid: 0 ~ 255
+    wouf_init (b);
+    return 0;
+}
+
+/**
+ * wou_pump - move the link without blocking: USB events, TX and RX
+ **/
+static void wou_pump (board_t* b)
+{
+    if (!b->xport->connected (b)) return;
+
+    b->xport->poll (b, XFER_ANY);
+    wou_send(b);
+    wou_recv(b);    // update GBN pointer if receiving Rn
+}
+
+/**
+ * wouf_wait - block until the window has an empty wouf
+ **/
+static void wouf_wait (board_t* b)
+{
+    wouf_t      *next_5_wouf_;
+    uint32_t    idle_cnt;
+    struct timespec time_busy;
+
+    next_5_wouf_ = next_5_wouf (b);
+
+    if (b->io_run) {
+        // the I/O thread moves the window; sleep until an ACK frees a slot
+        pthread_mutex_lock (&b->io_lock);
+        while (LOAD_ACQ(&next_5_wouf_->use)) {
+            struct timespec tabs;
+            clock_gettime(CLOCK_REALTIME, &tabs);
+            tabs.tv_nsec += WOU_BUSY_NSEC;
+            if (tabs.tv_nsec >= 1000000000) {
+                tabs.tv_sec += 1;
+                tabs.tv_nsec -= 1000000000;
+            }
+            if (pthread_cond_timedwait (&b->io_cond, &b->io_lock, &tabs) == ETIMEDOUT) {
+                ERRP ("WOU BUSY: Sm(0x%02X) Sn(0x%02X) Sb(0x%02X) clock(0x%02X)\n",
+                       b->wou->Sm, b->wou->Sn, b->wou->Sb, b->wou->clock);
+            }
+        }
+        pthread_mutex_unlock (&b->io_lock);
+        return;
     }
 
     idle_cnt = 0;
-    do {
+    time_busy.tv_sec = 0;   // set on the first wait
+    while (next_5_wouf_->use) {
         int rc;
-        struct timeval tv = {0,0};
-        struct ftdi_context *ftdic;
-    
-        ftdic = &(b->io.usb.ftdic);
 
         rc = 0;
-        while (ftdic->usb_connected == 0) {
+        while (!b->xport->connected (b)) {
             struct timespec time;
             time.tv_sec = 0;
             time.tv_nsec = 25000000;   // 25ms
             nanosleep(&time, NULL);
-            libusb_handle_events_timeout_completed(ftdic->usb_ctx, &tv, NULL);
+            b->xport->poll (b, XFER_ANY);
             if (rc == 0) {
                 // rc: prevent pollute screen with ERRP()
                 ERRP ("board.c: usb is not connected\n");
@@ -1555,47 +2019,108 @@ int wou_eof (board_t* b, uint8_t wouf_cmd)
             }
         }
 
-        assert (ftdic->usb_dev != NULL);
-        while ((rc = libusb_handle_events_timeout_completed(ftdic->usb_ctx, &tv, NULL)) != 0) {
-            ERRP("libusb_handle_events_timeout_completed(%d)\n", rc);
-        }
-
-        wou_send(b);
-        wou_recv(b);    // update GBN pointer if receiving Rn
+        wou_pump (b);
 
         if (next_5_wouf_->use)
         {
-            struct timespec treq, trem;
-            // request for 1ms to sleep
-            treq.tv_sec = 0;
-            treq.tv_nsec = 1000000;   // 1ms
-            if (nanosleep(&treq, &trem))
+            struct timespec time2, dt;
+
+            // sleep until a USB transfer completes, instead of a fixed
+            // tick; the ACK which frees a slot comes with an RX completion
+            b->xport->wait (b, WOU_WAIT_USEC);
+
+            clock_gettime(CLOCK_REALTIME, &time2);
+            if (time_busy.tv_sec == 0) time_busy = time2;
+            dt = diff(time_busy, time2);
+            if (dt.tv_sec > 0 || dt.tv_nsec > WOU_BUSY_NSEC)
             {
-                ERRP ("nanosleep got interrupted\n");
+                time_busy = time2;
+                ERRP ("WOU BUSY: %d\n", idle_cnt);
+                ERRP ("Sm(0x%02X) Sn(0x%02X) Sb(0x%02X) Sn.use(%d) clock(0x%02X)\n",
+                       b->wou->Sm, b->wou->Sn, b->wou->Sb, b->wou->woufs[b->wou->Sn].use, b->wou->clock);
+                // tidSb is the request of Rn from Receiver(FPGA)
+                ERRP ("Sm.use(%d) Sb.use(%d) clock(0x%02X)\n",
+                       b->wou->woufs[b->wou->Sm].use,
+                       b->wou->woufs[b->wou->Sb].use,
+                       b->wou->clock);
             }
         }
-
-        if (idle_cnt > 200)
-        {
-            ERRP ("WOU BUSY: %d\n", idle_cnt);
-            ERRP ("Sm(0x%02X) Sn(0x%02X) Sb(0x%02X) Sn.use(%d) clock(0x%02X)\n",
-                   b->wou->Sm, b->wou->Sn, b->wou->Sb, b->wou->woufs[b->wou->Sn].use, b->wou->clock);
-            // tidSb is the request of Rn from Receiver(FPGA)
-            ERRP ("Sm.use(%d) Sb.use(%d) clock(0x%02X)\n",
-                   b->wou->woufs[b->wou->Sm].use,
-                   b->wou->woufs[b->wou->Sb].use,
-                   b->wou->clock);
-        }
         idle_cnt ++;
-    } while (next_5_wouf_->use);
+    }
+}
 
-    // init the wouf buffer and tid
-    assert(wou_frame_->use == 0);   // wou protocol assume cur-wouf_ must be empty to write to
-    b->wou->tid += 1;   // tid: 0 ~ 255
-    wouf_init (b);
+/**
+ * wou_eof - close the current wouf, and flush pending [wou] packets;
+ *           wait for an empty wouf if the window is full
+ * returns 0
+ **/
+int wou_eof (board_t* b, uint8_t wouf_cmd)
+{
+    while (wouf_publish (b, wouf_cmd) == -1) {
+        wouf_wait (b);
+    }
+
+    if (b->wou->rt_cmd_callback) {
+        b->wou->rt_cmd_callback();
+    }
+
+    if (!b->io_run) {
+        // flush pending [wou] packets; the I/O thread does it otherwise
+        wou_pump (b);
+    }
     return 0;
 }
 
+/**
+ * wou_eof_nb - non-blocking wou_eof()
+ * returns 0 on success, or -1 with errno EAGAIN if the window is full;
+ *         the wouf is kept, and sent by a later wou_eof_nb()/wou_eof()
+ **/
+int wou_eof_nb (board_t* b, uint8_t wouf_cmd)
+{
+    int ret;
+
+    // the commands of producer threads go with this wouf, or the next
+    ret = stage_flush (b, wouf_cmd);
+
+    if (b->wou->rt_cmd_callback) {
+        b->wou->rt_cmd_callback();
+    }
+
+    if (!b->io_run) {
+        // flush pending [wou] packets, and take ACKs to free the window
+        wou_pump (b);
+    }
+
+    if (ret == -1) {
+        errno = EAGAIN;
+    }
+    return ret;
+}
+
+/**
+ * wou_window_get - snapshot of the window occupancy
+ **/
+void wou_window_get (board_t* b, wou_window_t *win)
+{
+    int used;   // woufs[] from Sb to clock
+    int sent;   // woufs[] from Sb to Sn
+
+    used = ((int) LOAD_ACQ(&b->wou->clock) - (int) LOAD_ACQ(&b->wou->Sb) + b->cfg.frames) % b->cfg.frames;
+    sent = ((int) LOAD_ACQ(&b->wou->Sn) - (int) LOAD_ACQ(&b->wou->Sb) + b->cfg.frames) % b->cfg.frames;
+    if (sent > used) sent = used;   // Sn/Sb moved in between
+
+    // wou_eof() needs 5 empty woufs after clock
+    win->free_frames = MAX(0, b->cfg.frames - 5 - used);
+    win->pending_frames = used - sent;
+    win->unacked_frames = sent;
+    win->queued_bytes = LOAD_ACQ(&b->wou->tx_size);
+    win->srtt_usec = LOAD_ACQ(&b->wou->srtt) / 1000;
+    win->rto_usec = LOAD_ACQ(&b->wou->rto) / 1000;
+    win->tx_burst = LOAD_ACQ(&b->wou->tx_burst);
+    win->rx_burst = LOAD_ACQ(&b->wou->rx_burst);
+}
+
 void wouf_init (board_t* b)
 {
     // took from vip/ftdi/generator.cpp::init_frame()
@@ -1605,6 +2130,11 @@ void wouf_init (board_t* b)
     cur_clock = (int) b->wou->clock;
     wou_frame_ = &(b->wou->woufs[cur_clock]);
 
+    // build the frame in place; it is written from tx_ring[] as is
+    if ((b->wou->tx_head + WOUF_MAX_FSIZE) > b->wou->tx_ring_size) {
+        b->wou->tx_head = 0;
+    }
+    wou_frame_->buf             = b->wou->tx_ring + b->wou->tx_head;
     wou_frame_->buf[0]          = WOUF_PREAMBLE;
     wou_frame_->buf[1]          = WOUF_PREAMBLE;
     wou_frame_->buf[2]          = WOUF_SOFD;    // Start of Frame Delimiter
@@ -1613,9 +2143,12 @@ void wouf_init (board_t* b)
     wou_frame_->buf[5]          = 0xFF;         // TID
     wou_frame_->buf[6]          = 0xFF;         // PLOAD_SIZE_RX
     wou_frame_->fsize           = 7;
+    wou_frame_->crc             = 0;            // CRC of no [WOU] packets
+    wou_frame_->crc_end         = 7;
+    wou_frame_->wr_last         = 0;
     wou_frame_->pload_size_rx   = 2;            // there would be no PAYLOAD in response WOU_FRAME,
                                                 // in this case the response frame would be composed of {PLOAD_SIZE_TX, WOUF_COMMAND, TID/MAIL_TAG}
-    wou_frame_->use             = 0;
+    STORE_REL(&wou_frame_->use, 0);
 
     return ;
 }
@@ -1627,6 +2160,11 @@ void rt_wouf_init (board_t* b)
 
     wou_frame_ = &(b->wou->rt_wouf);
 
+    // rt_head moves on only if the previous rt_wouf is queued for writing
+    if ((b->wou->rt_head + WOUF_MAX_FSIZE) > RT_RING_SIZE) {
+        b->wou->rt_head = 0;
+    }
+    wou_frame_->buf             = b->wou->rt_ring + b->wou->rt_head;
     wou_frame_->buf[0]          = WOUF_PREAMBLE;
     wou_frame_->buf[1]          = WOUF_PREAMBLE;
     wou_frame_->buf[2]          = WOUF_SOFD;    // Start of Frame Delimiter
@@ -1634,6 +2172,8 @@ void rt_wouf_init (board_t* b)
     wou_frame_->buf[4]          = 0xFF;         // WOUF_COMMAND
     wou_frame_->buf[5]          = 0xFF;         // PLOAD_SIZE_RX
     wou_frame_->fsize           = 6;
+    wou_frame_->crc             = 0;            // CRC of no [WOU] packets
+    wou_frame_->crc_end         = 6;
     wou_frame_->pload_size_rx   = 1;            // there could be no PAYLOAD in response WOU_FRAME,
                                                 // in this case the response frame would be composed of {PLOAD_SIZE_TX, WOUF_COMMAND, TID/MAIL_TAG}
     wou_frame_->use             = 0;
@@ -1676,12 +2216,14 @@ void rt_wou_append (
     memcpy (wou_frame_->buf + i, &wb_addr, WB_ADDR_SIZE);
     i+= WB_ADDR_SIZE;
     if (func == WB_WR_CMD) {
-        memcpy (wou_frame_->buf + i, buf, dsize);
+        wouf_copy (wou_frame_, i, buf, dsize);
         wou_frame_->fsize = i + dsize;
     } else  if (func == WB_RD_CMD) {
         wou_frame_->fsize = i;
         wou_frame_->pload_size_rx += (WOU_HDR_SIZE + dsize);
     }
+    // checksum the packets while they are hot in cache
+    wouf_crc (wou_frame_, WOUF_CRC_CHUNK);
     return;    
 }   // rt_wou_append()
 
@@ -1700,19 +2242,37 @@ int rt_wou_eof (board_t* b)
     wou_frame_->buf[4] = RT_WOUF;
     wou_frame_->buf[5] = 0xFF & (wou_frame_->pload_size_rx);
 
-    // calc CRC for {PLOAD_SIZE_TX, PLOAD_SIZE_RX, TID, WOU_PACKETS}
-    crc16 = crcFast(wou_frame_->buf + (WOUF_HDR_SIZE - 1), 
-                    wou_frame_->fsize - (WOUF_HDR_SIZE - 1)); 
+    // calc CRC for {PLOAD_SIZE_TX, RT_WOUF, PLOAD_SIZE_RX, WOU_PACKETS}:
+    // patch the header in front of the CRC of WOU_PACKETS
+    wouf_crc (wou_frame_, 0);
+    crc16 = crcCombine(crcFast(wou_frame_->buf + (WOUF_HDR_SIZE - 1), 3),
+                       wou_frame_->crc, wou_frame_->fsize - 6);
     memcpy (wou_frame_->buf + wou_frame_->fsize, &crc16, CRC_SIZE);
     wou_frame_->fsize += CRC_SIZE;
 
     /* rt_wouf 只有一個 WOU_FRAME, 不需要 check use bit */
     // wou_frame_->use = 1;    
 
+    if (b->io_run) {
+        // hand it over to the I/O thread; drop it if rt_q[] is full
+        uint32_t tail;
+
+        tail = b->wou->rt_q_tail;
+        if ((tail - LOAD_ACQ(&b->wou->rt_q_head)) < RT_Q_SIZE) {
+            b->wou->rt_q[tail & RT_Q_MASK].ptr = wou_frame_->buf;
+            b->wou->rt_q[tail & RT_Q_MASK].size = wou_frame_->fsize;
+            STORE_REL(&b->wou->rt_q_tail, tail + 1);
+            // keep it in rt_ring[] until written
+            b->wou->rt_head = (wou_frame_->buf - b->wou->rt_ring) + wou_frame_->fsize;
+        } else {
+            ERRP ("rt_q is full, drop RT_WOUF\n");
+        }
+    } else {
     // do {
         rt_wou_send(b);
         wou_recv(b);    // update GBN pointer if receiving Rn
     // } while (wou_frame_->use);
+    }
     
     // init the rt_wouf buffer
     rt_wouf_init (b);
@@ -1720,45 +2280,473 @@ int rt_wou_eof (board_t* b)
     return 0;
 } // rt_wou_eof()
 
-void wou_append (board_t* b, const uint8_t func, const uint16_t wb_addr, 
-                 const uint16_t dsize, const uint8_t* buf)
+/**
+ * io_rt_send - queue the rt_woufs handed over by rt_wou_eof()
+ **/
+static void io_rt_send (board_t* b)
 {
-    int         cur_clock;
-    wouf_t      *wou_frame_;
-    uint16_t    i;
+    uint32_t    head;
+    tx_iov_t    *rt;
+
+    head = b->wou->rt_q_head;
+    while (head != LOAD_ACQ(&b->wou->rt_q_tail)) {
+        rt = &(b->wou->rt_q[head & RT_Q_MASK]);
+        rt_tx_queue (b, rt->ptr, rt->size);
+        head ++;
+        STORE_REL(&b->wou->rt_q_head, head);
+    }
+}
 
-    cur_clock = (int) b->wou->clock;
-    wou_frame_ = &(b->wou->woufs[cur_clock]);
+/**
+ * io_thread - drive the link: USB events, GO-BACK-N and RX parsing
+ **/
+static void *io_thread (void *arg)
+{
+    board_t     *b;
+    uint64_t    wr_dsize;
+    uint64_t    rd_dsize;
+
+    b = (board_t *) arg;
+    while (!LOAD_ACQ(&b->io_stop)) {
+        wr_dsize = b->wr_dsize;
+        rd_dsize = b->rd_dsize;
+
+        b->xport->poll (b, XFER_ANY);
+        io_rt_send (b);
+        wou_send (b);
+        wou_recv (b);   // update GBN pointer if receiving Rn
+
+        if ((wr_dsize == b->wr_dsize) && (rd_dsize == b->rd_dsize)) {
+            // nothing moved; sleep until USB has news
+            b->xport->wait (b, IO_WAIT_USEC);
+        }
+    }
+    return NULL;
+}
 
-    // avoid exceeding WOUF_PAYLOAD limit
-    if (func == WB_WR_CMD) {
-        if ((wou_frame_->fsize - WOUF_HDR_SIZE + WOU_HDR_SIZE + dsize) 
-            > MAX_PSIZE) 
-        {
-            while(wou_eof (b, TYP_WOUF) == -1) {
-                printf("TODO: \n");
-                assert(0);
+/**
+ * board_io_start - hand the link over to a library-owned I/O thread
+ *   wou_eof() and rt_wou_eof() only publish finished frames from then on;
+ *   wou_eof() sleeps on io_cond while the window is full.  mbox_callback
+ *   and crc_error_callback are called from the I/O thread, rt_cmd_callback
+ *   from the thread closing woufs as before.
+ * returns 0 on success, -1 on failure
+ **/
+int board_io_start (board_t* board)
+{
+    int ret;
+
+    if (board->io_run) return 0;
+
+    board->io_stop = 0;
+    board->io_run = 1;
+    if ((ret = pthread_create (&board->io_thread, NULL, io_thread, board)) != 0) {
+        ERRP ("pthread_create(): %s\n", strerror (ret));
+        board->io_run = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * board_io_stop - take the link back from the I/O thread
+ **/
+void board_io_stop (board_t* board)
+{
+    if (!board->io_run) return;
+
+    STORE_REL(&board->io_stop, 1);
+    pthread_join (board->io_thread, NULL);
+    board->io_run = 0;
+}
+
+/**
+ * board_group_add - drive @board with the event loop of @group
+ *   Before board_connect(), the backend opens the board on the event
+ *   context of the group, and one poll of USB events per tick serves all
+ *   its boards.  A board connected already keeps its own context, which
+ *   board_group_poll() polls on its own.
+ * returns 0 on success, -1 if the group is full or @board is in a group
+ **/
+int board_group_add (board_group_t* group, board_t* board)
+{
+    if (board->group) {
+        ERRP ("board(%p) is in a group already\n", board);
+        return -1;
+    }
+    if (group->n == BOARD_GROUP_MAX) {
+        ERRP ("group(%p) is full: %d boards\n", group, group->n);
+        return -1;
+    }
+    group->boards[group->n] = board;
+    group->n ++;
+    board->group = group;
+    return 0;
+}
+
+/**
+ * board_group_flush - wou_eof_nb() of every board, with one tick of the
+ *                     event loop to send the frames of all of them
+ * returns 0 on success, or -1 with errno EAGAIN if the window of a board
+ *         is full; its wouf is kept, as wou_eof_nb() does
+ **/
+int board_group_flush (board_group_t* group, uint8_t wouf_cmd)
+{
+    board_t     *b;
+    int         ret;
+    int         i;
+
+    ret = 0;
+    for (i = 0; i < group->n; i++) {
+        b = group->boards[i];
+        if (stage_flush (b, wouf_cmd) == -1) {
+            ret = -1;
+        }
+        if (b->wou->rt_cmd_callback) {
+            b->wou->rt_cmd_callback();
+        }
+    }
+
+    // the I/O thread of a board flushes it; the others go in one tick
+    board_group_poll (group, 0);
+
+    if (ret == -1) {
+        errno = EAGAIN;
+    }
+    return ret;
+}
+
+/**
+ * board_group_poll - one tick of the event loop of @group
+ *   USB events are handled once for the boards on the group context, then
+ *   TX of every board goes before RX of any, so the writes of all boards
+ *   are on the bus together.  Boards of an I/O thread are skipped.
+ *   If no board moved, wait up to @usec for USB events.
+ * returns the number of boards with data written or received
+ **/
+int board_group_poll (board_group_t* group, int usec)
+{
+    board_t     *b;
+    board_t     *shared;
+    uint64_t    wr_dsize[BOARD_GROUP_MAX];
+    uint64_t    rd_dsize[BOARD_GROUP_MAX];
+    int         moved;
+    int         i;
+
+    shared = NULL;
+    for (i = 0; i < group->n; i++) {
+        b = group->boards[i];
+        if (b->io_run || !b->xport->connected (b)) continue;
+        wr_dsize[i] = b->wr_dsize;
+        rd_dsize[i] = b->rd_dsize;
+        if (!b->ev_shared) {
+            b->xport->poll (b, XFER_ANY);
+        } else if (shared == NULL) {
+            // the events of every board on the group context
+            b->xport->poll (b, XFER_ANY);
+            shared = b;
+        }
+        b->ev_polled = 1;
+    }
+
+    for (i = 0; i < group->n; i++) {
+        b = group->boards[i];
+        if (b->ev_polled) wou_send (b);
+    }
+    moved = 0;
+    for (i = 0; i < group->n; i++) {
+        b = group->boards[i];
+        if (!b->ev_polled) continue;
+        wou_recv (b);   // update GBN pointer if receiving Rn
+        b->ev_polled = 0;
+        if ((wr_dsize[i] != b->wr_dsize) || (rd_dsize[i] != b->rd_dsize)) {
+            moved ++;
+        }
+    }
+
+    if ((moved == 0) && (usec > 0)) {
+        // sleep until USB has news; on the group context, of any board
+        for (i = 0; i < group->n; i++) {
+            b = group->boards[i];
+            if (!b->io_run && b->xport->connected (b)) {
+                b->xport->wait (b, usec);
+                break;
             }
         }
-    } else if (func == WB_RD_CMD) {
-        if (((wou_frame_->fsize - WOUF_HDR_SIZE + WOU_HDR_SIZE) > MAX_PSIZE) 
-            || 
-            ((wou_frame_->pload_size_rx + WOU_HDR_SIZE + dsize) > MAX_PSIZE))
-        {
-            while(wou_eof (b, TYP_WOUF) == -1) {
-                printf("TODO: \n");
-                assert(0);;
+    }
+    return moved;
+}
+
+/**
+ * board_stage_open - a command queue for one producer thread
+ *   The queues of a board are merged in the order of their slots, which
+ *   is the order of board_stage_open() unless a closed one is reused.
+ * returns the queue, or NULL if STAGE_MAX queues are in use
+ **/
+wou_stage_t *board_stage_open (board_t* board)
+{
+    wou_stage_t *stage;
+    int         i;
+
+    stage = NULL;
+    pthread_mutex_lock (&board->stage_lock);
+    for (i = 0; i < board->stage_cnt; i++) {
+        if (!LOAD_ACQ(&board->stages[i]->used)) {
+            stage = board->stages[i];
+            break;
+        }
+    }
+    if ((stage == NULL) && (board->stage_cnt < STAGE_MAX)) {
+        stage = (wou_stage_t *) calloc (1, sizeof(wou_stage_t));
+        if (stage) {
+            // the framer sees stages[] up to stage_cnt
+            board->stages[board->stage_cnt] = stage;
+            STORE_REL(&board->stage_cnt, board->stage_cnt + 1);
+        }
+    }
+    if (stage) {
+        STORE_REL(&stage->used, 1);
+    }
+    pthread_mutex_unlock (&board->stage_lock);
+    if (stage == NULL) {
+        ERRP ("no command queue left of %d\n", STAGE_MAX);
+    }
+    return stage;
+}
+
+/**
+ * board_stage_close - give the queue back; staged commands still go out
+ **/
+void board_stage_close (wou_stage_t* stage)
+{
+    STORE_REL(&stage->used, 0);
+}
+
+// copy @size bytes in and out of stage->ring[] from @pos, wrapping at the end
+static void stage_put (wou_stage_t *stage, uint32_t pos, const uint8_t *buf, int size)
+{
+    int seg;
+
+    pos &= STAGE_MASK;
+    seg = MIN(size, STAGE_SIZE - (int) pos);
+    memcpy (stage->ring + pos, buf, seg);
+    memcpy (stage->ring, buf + seg, size - seg);
+}
+
+static void stage_get (const wou_stage_t *stage, uint32_t pos, uint8_t *buf, int size)
+{
+    int seg;
+
+    pos &= STAGE_MASK;
+    seg = MIN(size, STAGE_SIZE - (int) pos);
+    memcpy (buf, stage->ring + pos, seg);
+    memcpy (buf + seg, stage->ring, size - seg);
+}
+
+/**
+ * board_stage_cmd - wou_append() of a producer thread, into its own queue
+ *   lock-free; only the producer owning @stage may call it
+ * returns 0 on success, or -1 with errno EAGAIN if the queue is full
+ **/
+int board_stage_cmd (wou_stage_t* stage, const uint8_t func, const uint16_t wb_addr,
+                     const uint16_t dsize, const uint8_t* buf)
+{
+    uint8_t     hdr[WOU_HDR_SIZE];
+    uint32_t    head;
+    int         size;
+
+    assert (dsize <= MAX_DSIZE);
+    assert ((func == WB_WR_CMD) || (func == WB_RD_CMD));
+    size = WOU_HDR_SIZE + ((func == WB_WR_CMD) ? dsize : 0);
+    head = stage->head;
+    if ((STAGE_SIZE - (head - LOAD_ACQ(&stage->tail))) < (uint32_t) size) {
+        // the framer did not merge the queue for a while
+        errno = EAGAIN;
+        return -1;
+    }
+
+    hdr[0] = 0xFF & (func | (0x7F & dsize));
+    memcpy (hdr + 1, &wb_addr, WB_ADDR_SIZE);
+    stage_put (stage, head, hdr, WOU_HDR_SIZE);
+    if (func == WB_WR_CMD) {
+        stage_put (stage, head + WOU_HDR_SIZE, buf, dsize);
+    }
+    // hand the record over to the framer
+    STORE_REL(&stage->head, head + size);
+    return 0;
+}
+
+/**
+ * stage_merge - wouf_put() the commands staged by producer threads into
+ *               woufs[clock], queue by queue, each in the order of staging
+ *   Stops at the first command the wouf has no room for, which is left
+ *   staged; commands staged while merging go with the next wouf.
+ * returns 0 if the queues are merged, -1 if the wouf is full
+ **/
+static int stage_merge (board_t* b)
+{
+    wou_stage_t *stage;
+    wouf_t      *wou_frame_;
+    uint8_t     hdr[WOU_HDR_SIZE];
+    uint8_t     data[MAX_DSIZE];
+    uint32_t    head;
+    uint32_t    tail;
+    uint16_t    wb_addr;
+    uint8_t     func;
+    uint8_t     dsize;
+    int         ret;
+    int         n;
+    int         i;
+
+    ret = 0;
+    wou_frame_ = &(b->wou->woufs[b->wou->clock]);
+    n = LOAD_ACQ(&b->stage_cnt);
+    for (i = 0; (i < n) && (ret == 0); i++) {
+        stage = b->stages[i];
+        head = LOAD_ACQ(&stage->head);
+        tail = stage->tail;
+        while (tail != head) {
+            stage_get (stage, tail, hdr, WOU_HDR_SIZE);
+            func = hdr[0] & WB_WR_CMD;
+            dsize = hdr[0] & 0x7F;
+            if (!wouf_fits (wou_frame_, func, dsize)) {
+                ret = -1;
+                break;
+            }
+            memcpy (&wb_addr, hdr + 1, WB_ADDR_SIZE);
+            if (func == WB_WR_CMD) {
+                stage_get (stage, tail + WOU_HDR_SIZE, data, dsize);
+                tail += dsize;
             }
+            tail += WOU_HDR_SIZE;
+            wouf_put (b, wou_frame_, func, wb_addr, dsize, data);
         }
-    } else {
-        assert (0); // not a valid func
+        // the producer may reuse the space
+        STORE_REL(&stage->tail, tail);
     }
 
-    cur_clock = (int) b->wou->clock;
-    wou_frame_ = &(b->wou->woufs[cur_clock]);
-        
+    // checksum the packets while they are hot in cache
+    wouf_crc (wou_frame_, WOUF_CRC_CHUNK);
+    return ret;
+}
+
+/**
+ * stage_flush - stage_merge() and wouf_publish() until the queues of
+ *               producer threads are empty or the window is full; the
+ *               last wouf goes with @wouf_cmd.  Never blocks.
+ * returns 0 on success, or -1 if the window is full; the wouf and the
+ *         commands left staged go with a later stage_flush()
+ **/
+static int stage_flush (board_t* b, uint8_t wouf_cmd)
+{
+    while (stage_merge (b) == -1) {
+        if (wouf_publish (b, TYP_WOUF) == -1) {
+            return -1;
+        }
+    }
+    return wouf_publish (b, wouf_cmd);
+}
+
+/**
+ * wouf_fits - the wouf has room for a [WOU] packet of @func and @dsize
+ **/
+static int wouf_fits (const wouf_t *wou_frame_, const uint8_t func, const uint16_t dsize)
+{
+    // avoid exceeding WOUF_PAYLOAD limit
+    if (func == WB_WR_CMD) {
+        return ((wou_frame_->fsize - WOUF_HDR_SIZE + WOU_HDR_SIZE + dsize)
+                <= MAX_PSIZE);
+    }
+    return (((wou_frame_->fsize - WOUF_HDR_SIZE + WOU_HDR_SIZE) <= MAX_PSIZE)
+            && ((wou_frame_->pload_size_rx + WOU_HDR_SIZE + dsize) <= MAX_PSIZE));
+}
+
+/**
+ * wou_fifo_add - declare a WB_WR_CMD port taking a byte stream, such as
+ *                JCMD_SYNC_CMD, for wouf_merge()
+ * returns 0 on success, -1 if FIFO_PORT_MAX ports are declared
+ **/
+int wou_fifo_add (board_t* b, const uint16_t wb_addr, const uint16_t max_dsize)
+{
+    int i;
+
+    assert (max_dsize <= MAX_DSIZE);
+    for (i = 0; i < b->fifo_cnt; i++) {
+        if (b->fifo_addr[i] == wb_addr) break;
+    }
+    if (i == FIFO_PORT_MAX) {
+        ERRP ("FIFO ports: %d declared already\n", FIFO_PORT_MAX);
+        return -1;
+    }
+    b->fifo_addr[i] = wb_addr;
+    b->fifo_max[i] = max_dsize;
+    if (i == b->fifo_cnt) b->fifo_cnt ++;
+    return 0;
+}
+
+/**
+ * wouf_merge - take @dsize bytes of WB_WR_CMD to @wb_addr into the last
+ *              [WOU] packet of the wouf, if it writes the addresses right
+ *              before @wb_addr, or the same FIFO port
+ * returns 1 if merged, 0 if a new packet is due
+ **/
+static int wouf_merge (board_t* b, wouf_t *wou_frame_, const uint16_t wb_addr,
+                       const uint16_t dsize)
+{
+    uint8_t     *hdr;
+    uint16_t    last_addr;
+    uint8_t     last_dsize;
+    uint8_t     delta;
+    int         max;
+    int         i;
+
+    if (wou_frame_->wr_last == 0) return 0;
+    hdr = wou_frame_->buf + wou_frame_->wr_last;
+    last_dsize = hdr[0] & 0x7F;
+    memcpy (&last_addr, hdr + 1, WB_ADDR_SIZE);
+
+    // a FIFO port takes a stream of its own; no contiguous write runs
+    // into or out of it
+    max = MAX_DSIZE;
+    for (i = 0; i < b->fifo_cnt; i++) {
+        if ((b->fifo_addr[i] == last_addr) || (b->fifo_addr[i] == wb_addr)) {
+            if (last_addr != wb_addr) return 0;
+            max = b->fifo_max[i];
+            break;
+        }
+    }
+    if ((i == b->fifo_cnt) && ((uint16_t) (last_addr + last_dsize) != wb_addr)) return 0;
+    if ((last_dsize + dsize) > max) return 0;
+
+    // the header may be checksummed already; the CRC is linear, so XOR
+    // in the CRC of the change followed by the bytes after it
+    delta = hdr[0] ^ (0xFF & (WB_WR_CMD | (last_dsize + dsize)));
+    if (wou_frame_->crc_end > wou_frame_->wr_last) {
+        wou_frame_->crc ^= crcCombine (crcFast (&delta, 1), 0,
+                                       wou_frame_->crc_end - wou_frame_->wr_last - 1);
+    }
+    hdr[0] ^= delta;
+    return 1;
+}
+
+/**
+ * wouf_put - append a [WOU] packet to a wouf with room for it;
+ *            the CRC is left to wouf_crc()
+ **/
+static void wouf_put (board_t* b, wouf_t *wou_frame_, const uint8_t func, const uint16_t wb_addr,
+                      const uint16_t dsize, const uint8_t* buf)
+{
+    uint16_t    i;
+
     // DP ("func(0x%02X) dsize(0x%02X) wb_addr(0x%04X)\n", 
     //      func, dsize, wb_addr);
+
+    if ((func == WB_WR_CMD) && wouf_merge (b, wou_frame_, wb_addr, dsize)) {
+        // the data goes after the last packet, without a [WOU] header
+        wouf_copy (wou_frame_, wou_frame_->fsize, buf, dsize);
+        wou_frame_->fsize += dsize;
+        return;
+    }
     
     // code took from vip/ftdi/generator.cpp:
     i = wou_frame_->fsize;
@@ -1770,15 +2758,82 @@ void wou_append (board_t* b, const uint8_t func, const uint16_t wb_addr,
         // if (wb_addr == JCMD_SYNC_CMD) {
         //     fprintf  ... debug SYNC_CMD only
         // }
-        memcpy (wou_frame_->buf + i, buf, dsize);
+        wouf_copy (wou_frame_, i, buf, dsize);
+        wou_frame_->wr_last = i - WOU_HDR_SIZE;
         wou_frame_->fsize = i + dsize;
     } else  if (func == WB_RD_CMD) {
         wou_frame_->fsize = i;
         wou_frame_->pload_size_rx += (WOU_HDR_SIZE + dsize);
+        wou_frame_->wr_last = 0;
+    }
+}
+
+void wou_append (board_t* b, const uint8_t func, const uint16_t wb_addr, 
+                 const uint16_t dsize, const uint8_t* buf)
+{
+    wouf_t      *wou_frame_;
+
+    if ((func != WB_WR_CMD) && (func != WB_RD_CMD)) {
+        assert (0); // not a valid func
+    }
+
+    wou_frame_ = &(b->wou->woufs[b->wou->clock]);
+    if (!wouf_fits (wou_frame_, func, dsize)) {
+        wou_eof (b, TYP_WOUF);
+        wou_frame_ = &(b->wou->woufs[b->wou->clock]);
     }
+    wouf_put (b, wou_frame_, func, wb_addr, dsize, buf);
+
+    // checksum the packets while they are hot in cache
+    wouf_crc (wou_frame_, WOUF_CRC_CHUNK);
     return;    
 }
 
+/**
+ * wou_append_batch - wou_append() of @n [WOU] packets, checked already
+ *   A batch which fits an empty wouf but not the current one starts a new
+ *   wouf, to go out and be ACKed as a whole; a longer one fills woufs in
+ *   turn.  The room is checked, and the CRC brought up, once per wouf.
+ **/
+void wou_append_batch (board_t* b, const wou_op_t *ops, size_t n)
+{
+    wouf_t      *wou_frame_;
+    int         tx_size;
+    int         rx_size;
+    size_t      i;
+
+    tx_size = 0;
+    rx_size = 0;
+    for (i = 0; i < n; i++) {
+        tx_size += WOU_HDR_SIZE + ((ops[i].func == WB_WR_CMD) ? ops[i].dsize : 0);
+        if (ops[i].func == WB_RD_CMD) {
+            rx_size += WOU_HDR_SIZE + ops[i].dsize;
+        }
+    }
+    // wouf_init() leaves 3 bytes of TX payload and 2 of RX payload
+    wou_frame_ = &(b->wou->woufs[b->wou->clock]);
+    if (((7 - WOUF_HDR_SIZE + tx_size) <= MAX_PSIZE) && ((2 + rx_size) <= MAX_PSIZE)
+        && (((wou_frame_->fsize - WOUF_HDR_SIZE + tx_size) > MAX_PSIZE)
+            || ((wou_frame_->pload_size_rx + rx_size) > MAX_PSIZE))) {
+        wou_eof (b, TYP_WOUF);
+    }
+
+    i = 0;
+    while (i < n) {
+        wou_frame_ = &(b->wou->woufs[b->wou->clock]);
+        if (!wouf_fits (wou_frame_, ops[i].func, ops[i].dsize)) {
+            wou_eof (b, TYP_WOUF);
+            continue;
+        }
+        // as many packets as the wouf takes
+        do {
+            wouf_put (b, wou_frame_, ops[i].func, ops[i].wb_addr, ops[i].dsize, ops[i].data);
+            i ++;
+        } while ((i < n) && wouf_fits (wou_frame_, ops[i].func, ops[i].dsize));
+        wouf_crc (wou_frame_, WOUF_CRC_CHUNK);
+    }
+}
+
 
 static int m7i43u_reconfig (board_t* board)
 {
@@ -1786,35 +2841,15 @@ static int m7i43u_reconfig (board_t* board)
     uint8_t cBufWrite;
     int     i;
     int ret;
-    // unsigned int tx_chunksize;
-    struct ftdi_context *ftdic;
-    
-    ftdic = &(board->io.usb.ftdic);
         
     DP ("Park 7i43u in RECONFIG mode\n");
-    DP ("readbuffer_remaining(%u)\n",
-        board->io.usb.ftdic.readbuffer_remaining);
     
     // to clear tx and rx queue
-    if ((ret = ftdi_usb_purge_buffers (ftdic)) < 0)
+    if ((ret = board->xport->reset (board, 1)) < 0)
     {
-        ERRP ("ftdi_usb_purge_buffers() failed: %d", ret);
         return ret;
     }
-
-    // to flush rx queue
-    while (ret = ftdi_read_data (ftdic, &cBufWrite, 1) > 0) { 
-        DP ("flush %d byte\n", ret);
-        if (ftdic->readbuffer_remaining) {
-            DP ("flush %u byte\n", ftdic->readbuffer_remaining);
-            ftdi_read_data (ftdic, 
-                            board->wou->buf_tx,
-                            ftdic->readbuffer_remaining);
-        }
-    }
   
-    DP("ftdic->max_packet_size(%d)\n", ftdic->max_packet_size);
-    
     // use WOUF_COMMAND to reset Expected TID in FPGA
     DP ("RST_TID\n");
     gbn_init (board);
@@ -1827,19 +2862,21 @@ static int m7i43u_reconfig (board_t* board)
     wou_eof (board, TYP_WOUF);
     DP ("tx_size(%d)\n", board->wou->tx_size);
 
+    // write the queued frames synchronously
+    for (i=0; i<board->wou->tx_iov_cnt; i++) {
+        const tx_iov_t *iov = &(board->wou->tx_iov[i]);
 #if(TRACE)
-    DP ("buf_tx: tx_size(%d), ", board->wou->tx_size);
-    for (i=0; i<board->wou->tx_size; i++) {
-      DPS ("<%.2X>", board->wou->buf_tx[i]);
-    }
-    DPS ("\n");
+        int j;
+        DP ("buf_tx: size(%d), ", iov->size);
+        for (j=0; j<iov->size; j++) {
+          DPS ("<%.2X>", iov->ptr[j]);
+        }
+        DPS ("\n");
 #endif
-    
-    if ((ret = ftdi_write_data (ftdic, board->wou->buf_tx, board->wou->tx_size)) 
-        != board->wou->tx_size)
-    {
-        ERRP("ftdi_write_data: %d (%s)\n", ret, ftdi_get_error_string(ftdic));
-        return ret;
+        if ((ret = board->xport->write (board, iov->ptr, iov->size)) != iov->size)
+        {
+            return ret;
+        }
     }
     
     ERRP ("tx_size(%d)\n", board->wou->tx_size);
@@ -1848,17 +2885,9 @@ static int m7i43u_reconfig (board_t* board)
     time2.tv_nsec = 100000000;   // 100ms
     nanosleep(&time2, NULL);
     
-    DP ("rd_dsize(%llu), rx_tc(%p)\n", board->rd_dsize, board->io.usb.rx_tc);
+    DP ("rd_dsize(%llu)\n", board->rd_dsize);
     // to flush rx queue
-    while (ret = ftdi_read_data (ftdic, &cBufWrite, 1) > 0) { 
-        printf ("flush %d byte\n", ret);
-        if (ftdic->readbuffer_remaining) {
-            printf ("flush %u byte\n", ftdic->readbuffer_remaining);
-            ftdi_read_data (ftdic, 
-                            board->wou->buf_tx,
-                            ftdic->readbuffer_remaining);
-        }
-    }
+    board->xport->reset (board, 1);
     
     DP ("end of m7i43u_reconfig()\n");
     return (0);
@@ -1944,16 +2973,15 @@ int board_status (struct board *board)
     char tx_str[BUF_SIZE], rx_str[BUF_SIZE];
     double data_rate;   // overall data rate
     double cur_rate;    // current data rate
-    static uint64_t prev_dsize = 0;
 
     clock_gettime(CLOCK_REALTIME, &time2);
 
-    diff_time(&time_begin, &time2, &dt);
+    diff_time(&board->time_begin, &time2, &dt);
 
     ss = dt.tv_sec % 60;	// seconds
     
     // update for every seconds only
-    if ((ss > prev_ss) || ((ss == 0) && (prev_ss == 59))) {
+    if ((ss > board->prev_ss) || ((ss == 0) && (board->prev_ss == 59))) {
 
         dsize_to_str(tx_str, board->wr_dsize);
         dsize_to_str(rx_str, board->rd_dsize);
@@ -1962,14 +2990,14 @@ int board_status (struct board *board)
             data_rate =
                 (double) ((board->wr_dsize + board->rd_dsize) >> 10) // divide by 1024 for K-bytes
                           * 8.0 / dt.tv_sec; // *8 for bps
-            cur_rate = (double) ((board->wr_dsize + board->rd_dsize - prev_dsize) >> 10) // divide by 1024 for K-words
+            cur_rate = (double) ((board->wr_dsize + board->rd_dsize - board->prev_dsize) >> 10) // divide by 1024 for K-words
                           * 8.0; // for bps
-            prev_dsize = board->wr_dsize + board->rd_dsize;
+            board->prev_dsize = board->wr_dsize + board->rd_dsize;
         } else {
             data_rate = 0.0;
         }
 
-        prev_ss = ss;
+        board->prev_ss = ss;
         dt.tv_sec /= 60;
         mm = dt.tv_sec % 60;	// minutes
         hh = dt.tv_sec / 60;	// hr
@@ -8,7 +8,10 @@
 #define EC_FILE  102 /* File error of some sort. */
 #define EC_SYS   103 /* Beyond our scope. */
 
+#include <pthread.h>
+
 struct bitfile_chunk;
+struct wou_transport;
 
 #ifdef HAVE_LIBFTD2XX
 /* _Ftstat[]: take from _d2xx.h, PyUSB project, http://bleyer.org/pyusb/ */
@@ -81,6 +84,7 @@ static const _Ftstat Ftstat[] = {
 // #define BURST_MIN     128
 // #define BURST_MAX     1024
 // #define TX_BURST_MIN    128 // 2014-02-14
+// defaults of wou_config_t:
 #define TX_BURST_MIN    128
 #define TX_BURST_MAX    512
 //#define TX_CHUNK_SIZE   4096 // fail at MPCS
@@ -98,25 +102,139 @@ static const _Ftstat Ftstat[] = {
 //failed@1.2KV,16ms: #define BURST_LIMIT   32 // for debugging
 
 // GO-BACK-N: http://en.wikipedia.org/wiki/Go-Back-N_ARQ
-#define NR_OF_WIN     64     // window size for GO-BACK-N
-#define NR_OF_CLK     255    // number of circular buffer for WOU_FRAMEs
+// defaults, and limits, of wou_config_t.window and .frames
+#define NR_OF_WIN     64     // window size for GO-BACK-N; SACK_BITS
+#define NR_OF_CLK     255    // number of circular buffer for WOU_FRAMEs; 8-bit Sb/Sn/Sm
+#define NR_OF_CLK_GAP 8      // min .frames - .window: wou_eof() keeps 5 empty woufs
+
+// SELECTIVE-REPEAT: http://en.wikipedia.org/wiki/Selective_Repeat_ARQ
+// ARQ_SR requests sent before falling back to GO-BACK-N for good
+#define ARQ_SR_TRIES  3
+
+// TX TIMEOUT (RTO): SRTT + 4 * RTTVAR over the RTT of ACKed woufs
+#define RTO_INIT_NSEC   50000000    // until the first RTT sample
+#define RTO_MIN_NSEC    2000000     // ~3 base periods
+#define RTO_MAX_NSEC    500000000   // backoff limit
+
+// adaptive USB bursts: burst_adapt() moves the TX/RX burst sizes within
+// wou_config_t once a period, from what the period saw
+#define BURST_PERIOD_NSEC   5000000     // ~8 base periods
+#define BURST_LAT_NSEC      1000000     // a USB frame; slower writes shrink
+#define BURST_NAK_DIV       16          // shrink above 1 NAK per 16 ACKs
+
+// TX frames are built in place, back to back, in a ring of this size;
+// a frame never wraps, and .frames frames always fit
+#define WOUF_MAX_FSIZE  (WOUF_HDR_SIZE+MAX_PSIZE+CRC_SIZE)
+#define TX_RING_SIZE(frames)    (((frames)+2)*WOUF_MAX_FSIZE)
+#define RT_RING_SIZE    (4*WOUF_MAX_FSIZE)
+#define TX_IOV_MAX      8       // max segments queued for async write
+
+// wou_append() checksums [WOU] packets in runs of this many bytes
+#define WOUF_CRC_CHUNK  64
+
+// async transfers kept in flight per direction, to keep the USB pipe full
+#define TX_XFER_DEPTH   4
+#define RX_XFER_DEPTH   4
+
+// realtime frames handed to the I/O thread, must be power of 2
+#define RT_Q_SIZE       2
+#define RT_Q_MASK       (RT_Q_SIZE - 1)
+
+// the I/O thread waits this long for USB events when it is idle
+#define IO_WAIT_USEC    50
+
+// boards driven by one event loop, see board_group_add()
+#define BOARD_GROUP_MAX 8
+
+// WB_WR_CMD ports taking a byte stream, see wou_fifo_port()
+#define FIFO_PORT_MAX   8
+
+// WB commands staged by producer threads, see board_stage_open()
+#define STAGE_MAX       8       // producers per board
+#define STAGE_SIZE      4096    // bytes staged per producer, must be power of 2
+#define STAGE_MASK      (STAGE_SIZE - 1)
+
+// publish/observe a field shared with the I/O thread
+#define LOAD_ACQ(p)     __atomic_load_n ((p), __ATOMIC_ACQUIRE)
+#define STORE_REL(p, v) __atomic_store_n ((p), (v), __ATOMIC_RELEASE)
+
+// RX ring; a frame wrapping at the end is staged in rx_frame[] by rx_stage()
+// its size is the power of 2 of at least RX_RING_CHUNKS * .rx_chunk_size
+#define RX_RING_CHUNKS  32
+#define RX_CHUNK_MAX    65536   // limit of wou_config_t.rx_chunk_size
 
 enum rx_state_type {
   SYNC=0, PLOAD_CRC
 };
 
+/**
+ * wou_stage_t - lock-free queue of WB commands from one producer thread
+ * @head:   end of the staged records; written by the producer only
+ * @ring:   records of {func|dsize, WB_ADDR, DATA of WB_WR_CMD}; it keeps
+ *          @head and @tail on different cache lines
+ * @tail:   start of the records not merged yet; written by the framer only
+ * @used:   the queue belongs to a producer
+ **/
+typedef struct wou_stage {
+    uint32_t    head;
+    uint8_t     ring[STAGE_SIZE];
+    uint32_t    tail;
+    int         used;
+} wou_stage_t;
+
 /**
  * pkt_t -  packet for wishbone over usb protocol
  * @buf:    buffer to hold this [wou], buf[0] is tid
  * @size:   size in bytes for this [wou] 
  **/
 typedef struct wouf_struct {
-    uint8_t     buf[WOUF_HDR_SIZE+MAX_PSIZE+CRC_SIZE];   
+    uint8_t     *buf;           // points into tx_ring[] or rt_ring[]
     uint16_t    fsize;          // frame size in bytes
     uint16_t    pload_size_rx;  // Rx payload size in bytes
+    uint16_t    crc;            // CRC of the [WOU] packets up to crc_end
+    uint16_t    crc_end;
+    uint16_t    wr_last;        // the last [WOU] packet if a WB_WR_CMD, or 0
+    uint32_t    tx_seq;         // tx_seq of wou_t at the last send
+    int64_t     tx_ns;          // time of the first send, 0 for none
+    uint8_t     resent;         // sent more than once; no RTT sample
     uint8_t     use;
 } wouf_t;
 
+/**
+ * tx_iov_t - a segment of contiguous TX frames to be written
+ **/
+typedef struct tx_iov_struct {
+    const uint8_t   *ptr;
+    int             size;
+} tx_iov_t;
+
+/**
+ * burst_stat_t - link activity of a period, for burst_adapt()
+ * @begin:      start of the period, in ns
+ * @writes:     async writes completed
+ * @write_ns:   sum of their latency from submission to completion
+ * @queued:     sum of the bytes queued for write, in flight or not,
+ *              sampled by tx_submit()
+ * @samples:    number of @queued samples
+ * @acked:      woufs ACKed
+ * @naks:       NAKs, woufs re-sent on SACK, and TX TIMEOUTs
+ * @reads:      async reads completed
+ * @rd_req:     bytes they asked for
+ * @rd_got:     bytes they got
+ **/
+typedef struct burst_stat_struct {
+    int64_t     begin;
+    uint32_t    writes;
+    int64_t     write_ns;
+    uint64_t    queued;
+    uint32_t    samples;
+    uint32_t    acked;
+    uint32_t    naks;
+    uint32_t    reads;
+    uint64_t    rd_req;
+    uint64_t    rd_got;
+} burst_stat_t;
+
 // typedef void (*wou_mailbox_cb_fn)(const uint8_t *buf_head);
 
 /**
@@ -128,31 +246,112 @@ typedef struct wouf_struct {
  * //obsolete: @head_wait:          head of wou packets which is waiting for ACK
  * @tid:                transaction id for the upcomming wouf
  * @tidSb:              transaction id for sequence base(Sb)
- * @woufs[NR_OF_CLK]:   circular clock array of WOU_FRAMEs
+ * @woufs[frames]:      circular clock array of WOU_FRAMEs; with the I/O
+ *                      thread, it is the SPSC ring of finished frames:
+ *                      wou_eof() publishes a frame by setting its use flag,
+ *                      and the ACK of the frame clears it
  * @rt_wouf:            realtime WOU_FRAME
+ * @tx_size:            bytes queued in tx_iov[] for async write
+ * @tx_iov:             FIFO of segments in tx_ring[]/rt_ring[] to be written
+ * @tx_inflight:        bytes at the head of tx_iov[] being written
+ * @tx_xfer:            sizes of the async writes in flight, oldest first
+ * @tx_xfer_ns:         submission time of each write in @tx_xfer
+ * @tx_stale:           async writes in flight issued before a TX TIMEOUT
+ * @tx_ring:            storage of woufs[]; frames are sent from here
+ * @tx_ring_size:       size of tx_ring[], TX_RING_SIZE(frames)
+ * @tx_head:            offset in tx_ring[] for the next wouf
+ * @rt_ring:            storage of rt_wouf
+ * @rt_head:            offset in rt_ring[] for the next rt_wouf
+ * @rt_q:               finished rt_woufs for the I/O thread (SPSC)
+ * @rt_q_head:          next rt_q[] entry to be taken by the I/O thread
+ * @rt_q_tail:          next rt_q[] entry to be filled by rt_wou_eof()
+ * @buf_rx:             RX ring, with slack for a SYNC word look-ahead
+ * @rx_ring_size:       size of buf_rx[] without the slack, power of 2
+ * @rx_ring_mask:       rx_ring_size - 1
+ * @rx_head:            index of the next byte to parse in buf_rx[]
+ * @rx_tail:            index for the next async read into buf_rx[]
+ * @rx_req_size:        size of the async read in flight
+ * @rx_frame:           {PLOAD_SIZE_TX .. CRC} of the frame under CRC check,
+ *                      copied out of buf_rx[]; parsed only after CRC PASS
  * @clock:              clock pointer for next available wouf buffer
  * @Rn:                 request number
  * @Sn:                 sequence number
  * @Sb:                 sequence base of GBN
  * @Sm:                 sequence max of GBN
+ * @arq:                ARQ mode agreed with the FPGA, WOU_ARQ_GBN/WOU_ARQ_SR
+ * @arq_req:            ARQ mode requested by wou_set_arq()
+ * @arq_tries:          ARQ_SR requests sent since gbn_init()
+ * @arq_pending:        an ARQ_SR request is to be queued by wou_send()
+ * @arq_buf:            the ARQ_SR request frame
+ * @tx_seq:             number of woufs[] queued for async write so far;
+ *                      orders the sends for SELECTIVE-REPEAT
+ * @srtt:               smoothed RTT from send to ACK of a wouf, in ns
+ * @rttvar:             RTT variation, in ns
+ * @rto:                TX TIMEOUT of GO-BACK-N, in ns
+ * @tx_poll:            time of the last TX TIMEOUT check
+ * @time_send_begin:    time of the last async write submitted
+ * @time_send_success:  start of the TX TIMEOUT; reset by ACKs, and
+ *                      while nothing is in flight
+ * @tx_burst:           min size of an async write behind others in
+ *                      flight, .tx_burst_min ~ .tx_burst_max; set by
+ *                      burst_adapt()
+ * @rx_burst:           min size of an async read, .rx_burst_min ~
+ *                      .rx_chunk_size; set by burst_adapt()
+ * @burst:              activity of the current burst_adapt() period
+ * @err_seed:           rand_r() seed of the error generators
+ * @count_tx .. @count_rx_fail: counters of the error injection tests,
+ *                      TX_ERR_TEST etc. of board.c
  **/
 typedef struct wou_struct {
   uint8_t     tid;       
 //  uint8_t     tidSb;
-  wouf_t      woufs[NR_OF_CLK];    
+  wouf_t      *woufs;
   wouf_t      rt_wouf;
   int         tx_size;
-  int         rx_size;
   int         rx_req_size;
   int         rx_req;
-  uint8_t     buf_tx[NR_OF_WIN*(WOUF_HDR_SIZE+2/*PLOAD_SIZE_RX+TID*/+MAX_PSIZE+CRC_SIZE)];
-  uint8_t     buf_rx[NR_OF_WIN*(WOUF_HDR_SIZE+1/*TID_SIZE*/+MAX_PSIZE+CRC_SIZE)];
+  tx_iov_t    tx_iov[TX_IOV_MAX];
+  int         tx_iov_cnt;
+  int         tx_inflight;
+  int         tx_xfer[TX_XFER_DEPTH];
+  int64_t     tx_xfer_ns[TX_XFER_DEPTH];
+  int         tx_xfer_cnt;
+  int         tx_stale;
+  uint8_t     *tx_ring;
+  int         tx_ring_size;
+  int         tx_head;
+  uint8_t     rt_ring[RT_RING_SIZE];
+  int         rt_head;
+  tx_iov_t    rt_q[RT_Q_SIZE];
+  uint32_t    rt_q_head;
+  uint32_t    rt_q_tail;
+  uint8_t     *buf_rx;
+  uint32_t    rx_ring_size;
+  uint32_t    rx_ring_mask;
+  uint32_t    rx_head;
+  uint32_t    rx_tail;
+  uint8_t     rx_frame[1+MAX_PSIZE+CRC_SIZE];
   enum rx_state_type rx_state;
   uint8_t     clock;        
 //  uint8_t     Rn;
   uint8_t     Sn;
   uint8_t     Sb;    
   uint8_t     Sm;    
+  int         arq;
+  int         arq_req;
+  int         arq_tries;
+  int         arq_pending;
+  uint8_t     arq_buf[WOUF_HDR_SIZE+2+CRC_SIZE];
+  uint32_t    tx_seq;
+  int64_t     srtt;
+  int64_t     rttvar;
+  int64_t     rto;
+  struct timespec tx_poll;
+  struct timespec time_send_begin;
+  struct timespec time_send_success;
+  int         tx_burst;
+  int         rx_burst;
+  burst_stat_t burst;
   uint32_t    crc_error_counter;
   // callback functional pointers
   libwou_mailbox_cb_fn mbox_callback;
@@ -160,6 +359,13 @@ typedef struct wou_struct {
   libwou_rt_cmd_cb_fn rt_cmd_callback;
 
   int           error_gen_en;
+  unsigned int  err_seed;
+  uint32_t      count_tx;
+  uint32_t      count_rx;
+  uint32_t      count_single_break;
+  uint32_t      count_tx_fail;
+  uint32_t      count_reconnect;
+  uint32_t      count_rx_fail;
 
 } wou_t;
 
@@ -193,20 +399,63 @@ typedef struct board {
             FT_HANDLE	    ftHandle;
 #else
             struct ftdi_context ftdic;
-            struct ftdi_transfer_control *rx_tc;
-            struct ftdi_transfer_control *tx_tc;
+            // async writes in flight, oldest first
+            struct ftdi_transfer_control *tx_tc[TX_XFER_DEPTH];
+            int             tx_tc_cnt;
+            // bulk-in reads kept in flight, completed in ring order
+            struct libusb_transfer *rx_xfer[RX_XFER_DEPTH];
+            int             rx_state[RX_XFER_DEPTH];
+            int             rx_len[RX_XFER_DEPTH];  // payload after status bytes
+            int             rx_head;    // the oldest rx_xfer[]
+            int             rx_offset;  // payload of rx_xfer[rx_head] consumed
+            uint8_t         *rx_buf;    // pending read request
+            int             rx_req;
 #ifdef HAVE_LIBFTDI
 #endif  // HAVE_LIBFTDI
 #endif  // HAVE_LIBFTD2XX
             const char* 	binfile;
         } usb;
     } io;
+
+    // sizes of the window and of the USB transfers, see wou_init_config()
+    wou_config_t cfg;
+
+    // link layer backend, selected from board_table[] by board_init()
+    const struct wou_transport *xport;
+    void        *xport_data;    // private state of the backend
     
     // Wishbone Over USB protocol
     wou_t*      wou;   // circular buffer to keep track of wou packets
 
+    // library-owned I/O thread, see board_io_start()
+    pthread_t   io_thread;
+    int         io_run;     // the I/O thread owns the link
+    int         io_stop;    // request the I/O thread to exit
+    pthread_mutex_t io_lock;
+    pthread_cond_t  io_cond;    // signaled when an ACK frees woufs[]
+
+    // writes to these ports go in one [WOU] packet, up to fifo_max[] bytes
+    uint16_t    fifo_addr[FIFO_PORT_MAX];
+    uint8_t     fifo_max[FIFO_PORT_MAX];
+    int         fifo_cnt;
+
+    // queues of producer threads, merged by wou_eof_nb() in this order
+    wou_stage_t *stages[STAGE_MAX];
+    int         stage_cnt;
+    pthread_mutex_t stage_lock; // for board_stage_open()
+
+    // board group sharing one event loop, see board_group_add()
+    struct board_group *group;
+    int         ev_shared;  // USB events are handled on group->ctx
+    int         ev_polled;  // the events of this tick are handled already
+
     uint64_t    rd_dsize; // data size in bytes Received from USB
     uint64_t    wr_dsize; // data size in bytes written to USB
+
+    // for updating board_status:
+    struct timespec time_begin;
+    int         prev_ss;
+    uint64_t    prev_dsize;
     uint8_t     ready;
 
     // wisbone register map for this board
@@ -217,19 +466,49 @@ typedef struct board {
     
     int (*program_funct) (struct board *bd, struct bitfile_chunk *ch);
 } board_t;
+
+/**
+ * board_group_t - boards driven by one event loop
+ * @boards:     boards of the group, in the order of board_group_add()
+ * @n:          number of boards
+ * @ctx:        event context of the backend shared by the boards, the
+ *              libusb_context of ftdi; NULL until a board opens it
+ * @ctx_refs:   boards opened on @ctx; the last one to close frees it
+ **/
+typedef struct board_group {
+    board_t     *boards[BOARD_GROUP_MAX];
+    int         n;
+    void        *ctx;
+    int         ctx_refs;
+} board_group_t;
+
 int board_risc_prog(board_t* board, const char* binfile);
+void board_config_default (wou_config_t *cfg);
 int board_init (board_t* board, const char* device_type, const int device_id,
-                const char* bitfile);
+                const char* bitfile, const wou_config_t *cfg);
 int board_connect (board_t* board);
 int board_close (board_t* board);
 int board_status (board_t* board);
+int board_io_start (board_t* board);
+void board_io_stop (board_t* board);
+int board_group_add (board_group_t* group, board_t* board);
+int board_group_flush (board_group_t* group, uint8_t wouf_cmd);
+int board_group_poll (board_group_t* group, int usec);
+wou_stage_t *board_stage_open (board_t* board);
+int board_stage_cmd (wou_stage_t* stage, const uint8_t func, const uint16_t wb_addr,
+                     const uint16_t dsize, const uint8_t* buf);
+void board_stage_close (wou_stage_t* stage);
 //int board_reset (board_t* board);
 // int board_prog (board_t* board, char* filename);
 
 void wou_append (board_t* b, const uint8_t func, const uint16_t wb_addr, 
                  const uint16_t dsize, const uint8_t* buf);
+void wou_append_batch (board_t* b, const wou_op_t *ops, size_t n);
+int wou_fifo_add (board_t* b, const uint16_t wb_addr, const uint16_t max_dsize);
 void wou_recv (board_t* b);
 int wou_eof (board_t* b, uint8_t wouf_cmd);
+int wou_eof_nb (board_t* b, uint8_t wouf_cmd);
+void wou_window_get (board_t* b, wou_window_t *win);
 void wouf_init (board_t* b);
 
 void rt_wouf_init (board_t* b);
@@ -0,0 +1,191 @@
+/**********************************************************************
+ *
+ * Filename:    crc-gen.c
+ *
+ * Description: Generate crc_table.h, the static tables of crcFast().
+ *
+ * Notes:       Run "make crc-table" in src/wou after changing the CRC
+ *				standard of crc.h.  The tables are for the reflected
+ *				CRC-16 of crc.h: slice k holds the remainder of each
+ *				byte followed by k zero bytes.  The folding constants
+ *				of the carry-less multiply kernels are x^(d-1) mod P,
+ *				bit-reflected into 64 bits, for folding d bits ahead.
+ *				The powers x^(8n) and x^(2^k) mod P shift a CRC over
+ *				runs of zero bytes for crcCombine().
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include "crc.h"
+
+#define CRC_SLICES	8
+#define CRC_FOLDS	4	// fold distances of 512, 384, 256 and 128 bits
+#define CRC_X2N		32	// x^(2^k) for k < 32
+#define CRC_X8N		256	// x^(8n) for n < 256
+
+/*
+ * reflect() - reflect the low @nBits bits of @data
+ */
+static unsigned long
+reflect(unsigned long data, unsigned char nBits)
+{
+	unsigned long  reflection = 0x00000000;
+	unsigned char  bit;
+
+	for (bit = 0; bit < nBits; ++bit)
+	{
+		if (data & 0x01)
+		{
+			reflection |= (1 << ((nBits - 1) - bit));
+		}
+		data = (data >> 1);
+	}
+	return (reflection);
+}
+
+/*
+ * fold_const() - x^(n-1) mod P, bit-reflected into 64 bits
+ */
+static uint64_t
+fold_const(int n)
+{
+    uint32_t    r = 1;
+    uint64_t    k = 0;
+    int         bit;
+
+    while (--n > 0)
+    {
+        r <<= 1;
+        if (r & (1UL << WIDTH))
+        {
+            r ^= (1UL << WIDTH) | POLYNOMIAL;
+        }
+    }
+    for (bit = 0; bit < WIDTH; bit++)
+    {
+        if (r & (1UL << bit))
+        {
+            k |= 1ULL << (63 - bit);
+        }
+    }
+    return k;
+}
+
+/*
+ * mul_modp() - a * b mod P, both bit-reflected; x^0 is the top bit
+ */
+static uint16_t
+mul_modp(uint16_t a, uint16_t b, uint16_t poly)
+{
+    uint16_t    m = 1 << (WIDTH - 1);
+    uint16_t    p = 0;
+
+    while (m)
+    {
+        if (a & m)
+        {
+            p ^= b;
+        }
+        m >>= 1;
+        b = (b & 1) ? ((b >> 1) ^ poly) : (b >> 1);
+    }
+    return p;
+}
+
+int
+main(void)
+{
+    uint16_t    table[CRC_SLICES][256];
+    uint16_t    poly;
+    uint16_t    r;
+    int         dividend;
+    int         bit;
+    int         k;
+
+    poly = (uint16_t) reflect(POLYNOMIAL, WIDTH);
+    for (dividend = 0; dividend < 256; ++dividend)
+    {
+        r = dividend;
+        for (bit = 8; bit > 0; --bit)
+        {
+            r = (r & 1) ? ((r >> 1) ^ poly) : (r >> 1);
+        }
+        table[0][dividend] = r;
+    }
+    for (k = 1; k < CRC_SLICES; k++)
+    {
+        for (dividend = 0; dividend < 256; ++dividend)
+        {
+            r = table[k - 1][dividend];
+            table[k][dividend] = (r >> 8) ^ table[0][r & 0xFF];
+        }
+    }
+
+    printf ("/*\n");
+    printf (" * crc_table.h - slicing-by-%d tables of %s, reflected polynomial 0x%04X\n",
+            CRC_SLICES, CRC_NAME, poly);
+    printf (" *\n");
+    printf (" * Generated by crc-gen.c; do not edit.\n");
+    printf (" */\n\n");
+    printf ("#define CRC_SLICES\t%d\n\n", CRC_SLICES);
+    printf ("static const uint16_t crcSlice[CRC_SLICES][256] =\n{\n");
+    for (k = 0; k < CRC_SLICES; k++)
+    {
+        printf ("    {\n");
+        for (dividend = 0; dividend < 256; ++dividend)
+        {
+            printf ("%s0x%04X%s", ((dividend % 8) == 0) ? "        " : " ",
+                    table[k][dividend],
+                    (dividend == 255) ? "\n" : (((dividend % 8) == 7) ? ",\n" : ","));
+        }
+        printf ("    }%s\n", (k == (CRC_SLICES - 1)) ? "" : ",");
+    }
+    printf ("};\n\n");
+
+    printf ("/*\n");
+    printf (" * Folding constants of the carry-less multiply kernels, to fold 128\n");
+    printf (" * bits d bits ahead: {x^(d+63), x^(d-1)} mod P, bit-reflected.\n");
+    printf (" */\n");
+    printf ("#define CRC_FOLDS\t%d\n\n", CRC_FOLDS);
+    printf ("static const uint64_t crcFold[CRC_FOLDS][2] =\n{\n");
+    for (k = 0; k < CRC_FOLDS; k++)
+    {
+        int d = 128 * (CRC_FOLDS - k);
+        printf ("    {0x%016llXULL, 0x%016llXULL}%s\t// d = %d\n",
+                (unsigned long long) fold_const(d + 64),
+                (unsigned long long) fold_const(d),
+                (k == (CRC_FOLDS - 1)) ? "" : ",", d);
+    }
+    printf ("};\n\n");
+
+    printf ("/*\n");
+    printf (" * x^(2^k) mod P, bit-reflected, for crcCombine()\n");
+    printf (" */\n");
+    printf ("#define CRC_POLY_REFLECTED\t0x%04X\n", poly);
+    printf ("#define CRC_X2N\t\t%d\n\n", CRC_X2N);
+    printf ("static const uint16_t crcX2n[CRC_X2N] =\n{\n");
+    r = 1 << (WIDTH - 2);   // x^1
+    for (k = 0; k < CRC_X2N; k++)
+    {
+        printf ("%s0x%04X%s", ((k % 8) == 0) ? "    " : " ", r,
+                (k == (CRC_X2N - 1)) ? "\n" : (((k % 8) == 7) ? ",\n" : ","));
+        r = mul_modp (r, r, poly);
+    }
+    printf ("};\n\n");
+
+    printf ("/*\n");
+    printf (" * x^(8n) mod P, bit-reflected: a CRC shifted over n zero bytes\n");
+    printf (" */\n");
+    printf ("#define CRC_X8N\t\t%d\n\n", CRC_X8N);
+    printf ("static const uint16_t crcX8n[CRC_X8N] =\n{\n");
+    r = 1 << (WIDTH - 1);   // x^0
+    for (k = 0; k < CRC_X8N; k++)
+    {
+        printf ("%s0x%04X%s", ((k % 8) == 0) ? "    " : " ", r,
+                (k == (CRC_X8N - 1)) ? "\n" : (((k % 8) == 7) ? ",\n" : ","));
+        r = mul_modp (r, 1 << (WIDTH - 9), poly);  // x^8
+    }
+    printf ("};\n");
+    return 0;
+}
@@ -1,253 +1,724 @@
-/**********************************************************************
- *
- * Filename:    crc.c
- * 
- * Description: Slow and fast implementations of the CRC standards.
- *
- * Notes:       The parameters for each supported CRC standard are
- *				defined in the header file crc.h.  The implementations
- *				here should stand up to further additions to that list.
- *
- * 
- * Copyright (c) 2000 by Michael Barr.  This software is placed into
- * the public domain and may be used for any purpose.  However, this
- * notice must not be changed or removed and no warranty is either
- * expressed or implied by its publication or distribution.
- **********************************************************************/
-
-#include "stdint.h"
-#include "crc.h"
-
-crc       crcTable[256];
-uint8_t   reflect8_table[256];
-uint16_t  reflect16_table[65536];
-
-/*
- * Derive parameters from the standard-specific parameters in crc.h.
- */
-#define TOPBIT   (1 << (WIDTH - 1))
-
-#if (REFLECT_DATA == TRUE)
-#undef  REFLECT_DATA
-//orig: #define REFLECT_DATA(X)			((unsigned char) reflect((X), 8))
-#define REFLECT_DATA(X)			(reflect8_table[(X)])
-#else
-#undef  REFLECT_DATA
-#define REFLECT_DATA(X)			(X)
-#endif
-
-#if (REFLECT_REMAINDER == TRUE)
-#undef  REFLECT_REMAINDER
-#if (WIDTH == 16)
-#define REFLECT_REMAINDER(X)	((crc) reflect16_table[(X)])
-#else
-#define REFLECT_REMAINDER(X)	((crc) reflect((X), WIDTH))
-#endif
-#else
-#undef  REFLECT_REMAINDER
-#define REFLECT_REMAINDER(X)	(X)
-#endif
-
-
-/*********************************************************************
- *
- * Function:    reflect()
- * 
- * Description: Reorder the bits of a binary sequence, by reflecting
- *				them about the middle position.
- *
- * Notes:		No checking is done that nBits <= 32.
- *
- * Returns:		The reflection of the original data.
- *
- *********************************************************************/
-static unsigned long
-reflect(unsigned long data, unsigned char nBits)
-{
-	unsigned long  reflection = 0x00000000;
-	unsigned char  bit;
-
-	/*
-	 * Reflect the data about the center bit.
-	 */
-	for (bit = 0; bit < nBits; ++bit)
-	{
-		/*
-		 * If the LSB bit is set, set the reflection of it.
-		 */
-		if (data & 0x01)
-		{
-			reflection |= (1 << ((nBits - 1) - bit));
-		}
-
-		data = (data >> 1);
-	}
-
-	return (reflection);
-
-}	/* reflect() */
-
-
-/*********************************************************************
- *
- * Function:    crcSlow()
- * 
- * Description: Compute the CRC of a given message.
- *
- * Notes:		
- *
- * Returns:		The CRC of the message.
- *
- *********************************************************************/
-crc
-crcSlow(unsigned char const message[], int nBytes)
-{
-    crc            remainder = INITIAL_REMAINDER;
-	int            byte;
-	unsigned char  bit;
-
-
-    /*
-     * Perform modulo-2 division, a byte at a time.
-     */
-    for (byte = 0; byte < nBytes; ++byte)
-    {
-        /*
-         * Bring the next byte into the remainder.
-         */
-        remainder ^= (REFLECT_DATA(message[byte]) << (WIDTH - 8));
-
-        /*
-         * Perform modulo-2 division, a bit at a time.
-         */
-        for (bit = 8; bit > 0; --bit)
-        {
-            /*
-             * Try to divide the current data bit.
-             */
-            if (remainder & TOPBIT)
-            {
-                remainder = (remainder << 1) ^ POLYNOMIAL;
-            }
-            else
-            {
-                remainder = (remainder << 1);
-            }
-        }
-    }
-
-    /*
-     * The final remainder is the CRC result.
-     */
-    return (REFLECT_REMAINDER(remainder) ^ FINAL_XOR_VALUE);
-
-}   /* crcSlow() */
-
-
-/*********************************************************************
- *
- * Function:    crcInit()
- * 
- * Description: Populate the partial CRC lookup table.
- *
- * Notes:		This function must be rerun any time the CRC standard
- *				is changed.  If desired, it can be run "offline" and
- *				the table results stored in an embedded system's ROM.
- *
- * Returns:		None defined.
- *
- *********************************************************************/
-void
-crcInit(void)
-{
-    crc		      remainder;
-    int		      dividend;
-    unsigned char     bit;
-    uint32_t          id;
-
-
-    /*
-     * Compute the remainder of each possible dividend.
-     */
-    for (dividend = 0; dividend < 256; ++dividend)
-    {
-        /*
-         * Start with the dividend followed by zeros.
-         */
-        remainder = dividend << (WIDTH - 8);
-
-        /*
-         * Perform modulo-2 division, a bit at a time.
-         */
-        for (bit = 8; bit > 0; --bit)
-        {
-            /*
-             * Try to divide the current data bit.
-             */			
-            if (remainder & TOPBIT)
-            {
-                remainder = (remainder << 1) ^ POLYNOMIAL;
-            }
-            else
-            {
-                remainder = (remainder << 1);
-            }
-        }
-
-        /*
-         * Store the result into the table.
-         */
-        crcTable[dividend] = remainder;
-    }
-    
-    /*
-     * Compute the reflection table for 0~255
-     */
-    for (id=0; id<256; id++) {
-        reflect8_table[id] = (uint8_t) reflect(id, 8);
-    }
-
-    /*
-     * Compute the reflection table for 0~65535
-     */
-    for (id=0; id<65536; id++) {
-        reflect16_table[id] = (uint16_t) reflect(id, 16);
-    }
-
-}   /* crcInit() */
-
-
-/*********************************************************************
- *
- * Function:    crcFast()
- * 
- * Description: Compute the CRC of a given message.
- *
- * Notes:		crcInit() must be called first.
- *
- * Returns:		The CRC of the message.
- *
- *********************************************************************/
-crc
-crcFast(unsigned char const message[], int nBytes)
-{
-    crc	           remainder = INITIAL_REMAINDER;
-    unsigned char  data;
-	int            byte;
-
-
-    /*
-     * Divide the message by the polynomial, a byte at a time.
-     */
-    for (byte = 0; byte < nBytes; ++byte)
-    {
-        data = REFLECT_DATA(message[byte]) ^ (remainder >> (WIDTH - 8));
-  	remainder = crcTable[data] ^ (remainder << 8);
-    }
-
-    /*
-     * The final remainder is the CRC.
-     */
-    return (REFLECT_REMAINDER(remainder) ^ FINAL_XOR_VALUE);
-
-}   /* crcFast() */
+/**********************************************************************
+ *
+ * Filename:    crc.c
+ * 
+ * Description: Slow and fast implementations of the CRC standards.
+ *
+ * Notes:       The parameters for each supported CRC standard are
+ *				defined in the header file crc.h.  The implementations
+ *				here should stand up to further additions to that list.
+ *
+ * 
+ * Copyright (c) 2000 by Michael Barr.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+
+#include "stdint.h"
+#include <string.h>
+#include <pthread.h>
+#include "crc.h"
+
+/*
+ * Slicing-by-8 tables of the reflected polynomial, for crcFast():
+ * crcSlice[0] is the byte-wise table; crcSlice[k][i] is the remainder
+ * of byte i followed by k zero bytes.  They are static const data,
+ * generated by crc-gen.c.
+ */
+#include "crc_table.h"
+
+/*
+ * Derive parameters from the standard-specific parameters in crc.h.
+ */
+#define TOPBIT   (1 << (WIDTH - 1))
+
+#if (WIDTH != 16) || (REFLECT_DATA != TRUE) || (REFLECT_REMAINDER != TRUE)
+#error "crcFast() is written for a reflected CRC-16"
+#endif
+
+#if (INITIAL_REMAINDER != 0) || (FINAL_XOR_VALUE != 0)
+#error "crcCombine() is written for a CRC without initial and final XOR"
+#endif
+
+#if (REFLECT_DATA == TRUE)
+#undef  REFLECT_DATA
+#define REFLECT_DATA(X)			((unsigned char) reflect((X), 8))
+#else
+#undef  REFLECT_DATA
+#define REFLECT_DATA(X)			(X)
+#endif
+
+#if (REFLECT_REMAINDER == TRUE)
+#undef  REFLECT_REMAINDER
+#define REFLECT_REMAINDER(X)	((crc) reflect((X), WIDTH))
+#else
+#undef  REFLECT_REMAINDER
+#define REFLECT_REMAINDER(X)	(X)
+#endif
+
+
+/*********************************************************************
+ *
+ * Function:    reflect()
+ * 
+ * Description: Reorder the bits of a binary sequence, by reflecting
+ *				them about the middle position.
+ *
+ * Notes:		No checking is done that nBits <= 32.
+ *
+ * Returns:		The reflection of the original data.
+ *
+ *********************************************************************/
+static unsigned long
+reflect(unsigned long data, unsigned char nBits)
+{
+	unsigned long  reflection = 0x00000000;
+	unsigned char  bit;
+
+	/*
+	 * Reflect the data about the center bit.
+	 */
+	for (bit = 0; bit < nBits; ++bit)
+	{
+		/*
+		 * If the LSB bit is set, set the reflection of it.
+		 */
+		if (data & 0x01)
+		{
+			reflection |= (1 << ((nBits - 1) - bit));
+		}
+
+		data = (data >> 1);
+	}
+
+	return (reflection);
+
+}	/* reflect() */
+
+
+/*********************************************************************
+ *
+ * Function:    crcSlow()
+ * 
+ * Description: Compute the CRC of a given message.
+ *
+ * Notes:		
+ *
+ * Returns:		The CRC of the message.
+ *
+ *********************************************************************/
+crc
+crcSlow(unsigned char const message[], int nBytes)
+{
+    crc            remainder = INITIAL_REMAINDER;
+	int            byte;
+	unsigned char  bit;
+
+
+    /*
+     * Perform modulo-2 division, a byte at a time.
+     */
+    for (byte = 0; byte < nBytes; ++byte)
+    {
+        /*
+         * Bring the next byte into the remainder.
+         */
+        remainder ^= (REFLECT_DATA(message[byte]) << (WIDTH - 8));
+
+        /*
+         * Perform modulo-2 division, a bit at a time.
+         */
+        for (bit = 8; bit > 0; --bit)
+        {
+            /*
+             * Try to divide the current data bit.
+             */
+            if (remainder & TOPBIT)
+            {
+                remainder = (remainder << 1) ^ POLYNOMIAL;
+            }
+            else
+            {
+                remainder = (remainder << 1);
+            }
+        }
+    }
+
+    /*
+     * The final remainder is the CRC result.
+     */
+    return (REFLECT_REMAINDER(remainder) ^ FINAL_XOR_VALUE);
+
+}   /* crcSlow() */
+
+
+static void crcResolve(void);
+
+/*********************************************************************
+ *
+ * Function:    crcInit()
+ * 
+ * Description: Pick the kernel of crcFast() for this CPU, once for
+ *				the process.
+ *
+ * Notes:		Idempotent and thread-safe; every board calls it.
+ *				The lookup tables are static const data of
+ *				crc_table.h, generated offline by crc-gen.c, and
+ *				crcFast() picks the kernel on its first call if
+ *				crcInit() was never called.
+ *
+ * Returns:		None defined.
+ *
+ *********************************************************************/
+void
+crcInit(void)
+{
+    static pthread_once_t   once = PTHREAD_ONCE_INIT;
+
+    pthread_once (&once, crcResolve);
+
+}   /* crcInit() */
+
+
+/*
+ * Divide 8 bytes at @q into @r, the remainder so far.
+ */
+#define SLICE8(r, q)	do { \
+        (r) ^= (q)[0] | ((q)[1] << 8); \
+        (r) = crcSlice[7][(r) & 0xFF] ^ crcSlice[6][(r) >> 8] \
+            ^ crcSlice[5][(q)[2]] ^ crcSlice[4][(q)[3]] \
+            ^ crcSlice[3][(q)[4]] ^ crcSlice[2][(q)[5]] \
+            ^ crcSlice[1][(q)[6]] ^ crcSlice[0][(q)[7]]; \
+        (q) += CRC_SLICES; \
+    } while (0)
+
+/*
+ * The kernels below come in two flavors from one body: checksum only,
+ * and copy-and-checksum, which also stores each block it loads to @dst.
+ */
+#define CRC_BODY	static inline __attribute__((always_inline))
+
+
+/*********************************************************************
+ *
+ * Function:    crcSlice8()
+ * 
+ * Description: Continue the CRC of a message from a given remainder.
+ *
+ * Notes:		Slicing-by-8 with the reflected tables of crc_table.h;
+ *				bit-exact with crcSlow() for the reflected CRC-16.
+ *
+ * Returns:		The remainder after the message.
+ *
+ *********************************************************************/
+CRC_BODY uint16_t
+crcSlice8Body(uint16_t remainder, unsigned char *dst,
+              unsigned char const *p, int nBytes, int const copy)
+{
+    /*
+     * Divide the message by the polynomial, 8 bytes at a time.
+     */
+    while (nBytes >= CRC_SLICES)
+    {
+        if (copy)
+        {
+            memcpy (dst, p, CRC_SLICES);
+            dst += CRC_SLICES;
+        }
+        SLICE8(remainder, p);
+        nBytes -= CRC_SLICES;
+    }
+
+    /*
+     * ... and the rest, a byte at a time.
+     */
+    while (nBytes-- > 0)
+    {
+        if (copy)
+        {
+            *dst++ = *p;
+        }
+        remainder = (remainder >> 8) ^ crcSlice[0][(remainder ^ *p++) & 0xFF];
+    }
+
+    return (remainder);
+
+}   /* crcSlice8Body() */
+
+static uint16_t
+crcSlice8(uint16_t remainder, unsigned char const *p, int nBytes)
+{
+    return (crcSlice8Body (remainder, NULL, p, nBytes, 0));
+}
+
+static uint16_t
+crcSlice8Copy(uint16_t remainder, unsigned char *dst, unsigned char const *p, int nBytes)
+{
+    return (crcSlice8Body (remainder, dst, p, nBytes, 1));
+}
+
+
+/*
+ * Carry-less multiply kernels: fold the message 64 bytes at a time in
+ * four 128-bit lanes, then 16 bytes at a time in one lane, with the
+ * constants of crc_table.h.  A folded lane is congruent to the message
+ * modulo the polynomial, so its CRC and the tail come from crcSlice8().
+ * Messages shorter than 64 bytes start in one lane; the setup does not
+ * pay off below CRC_FOLD_MIN bytes.
+ */
+#define CRC_FOLD_MIN	48
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <wmmintrin.h>
+
+#define FOLD(x, k)	_mm_xor_si128 (_mm_clmulepi64_si128 ((x), (k), 0x00), \
+                                   _mm_clmulepi64_si128 ((x), (k), 0x11))
+#define FOLD_K(i)	_mm_set_epi64x ((long long) crcFold[i][1], \
+                                    (long long) crcFold[i][0])
+
+__attribute__((target("sse2,pclmul")))
+CRC_BODY __m128i
+crcLoad(unsigned char *dst, unsigned char const *p, int i, int const copy)
+{
+    __m128i     v = _mm_loadu_si128 ((__m128i const *) (p + i));
+
+    if (copy)
+    {
+        _mm_storeu_si128 ((__m128i *) (dst + i), v);
+    }
+    return (v);
+}
+
+__attribute__((target("sse2,pclmul")))
+CRC_BODY uint16_t
+crcFoldPclmulBody(uint16_t remainder, unsigned char *dst,
+                  unsigned char const *p, int nBytes, int const copy)
+{
+    __m128i         x0, x1, x2, x3;
+    __m128i         k;
+    unsigned char   lane[16];
+    int             i = 0;
+
+    x0 = _mm_xor_si128 (crcLoad (dst, p, i, copy), _mm_cvtsi32_si128 (remainder));
+    if (nBytes >= 64)
+    {
+        x1 = crcLoad (dst, p, i + 16, copy);
+        x2 = crcLoad (dst, p, i + 32, copy);
+        x3 = crcLoad (dst, p, i + 48, copy);
+        i += 64;
+        nBytes -= 64;
+
+        k = FOLD_K(0);
+        while (nBytes >= 64)
+        {
+            x0 = _mm_xor_si128 (FOLD(x0, k), crcLoad (dst, p, i, copy));
+            x1 = _mm_xor_si128 (FOLD(x1, k), crcLoad (dst, p, i + 16, copy));
+            x2 = _mm_xor_si128 (FOLD(x2, k), crcLoad (dst, p, i + 32, copy));
+            x3 = _mm_xor_si128 (FOLD(x3, k), crcLoad (dst, p, i + 48, copy));
+            i += 64;
+            nBytes -= 64;
+        }
+
+        x0 = _mm_xor_si128 (_mm_xor_si128 (FOLD(x0, FOLD_K(1)), FOLD(x1, FOLD_K(2))),
+                            _mm_xor_si128 (FOLD(x2, FOLD_K(3)), x3));
+    }
+    else
+    {
+        i += 16;
+        nBytes -= 16;
+    }
+
+    k = FOLD_K(3);
+    while (nBytes >= 16)
+    {
+        x0 = _mm_xor_si128 (FOLD(x0, k), crcLoad (dst, p, i, copy));
+        i += 16;
+        nBytes -= 16;
+    }
+
+    _mm_storeu_si128 ((__m128i *) lane, x0);
+    return (crcSlice8Body (crcSlice8 (0, lane, 16),
+                           copy ? (dst + i) : NULL, p + i, nBytes, copy));
+
+}   /* crcFoldPclmulBody() */
+
+__attribute__((target("sse2,pclmul")))
+static uint16_t
+crcFoldPclmul(uint16_t remainder, unsigned char const *p, int nBytes)
+{
+    return (crcFoldPclmulBody (remainder, NULL, p, nBytes, 0));
+}
+
+__attribute__((target("sse2,pclmul")))
+static uint16_t
+crcFoldPclmulCopy(uint16_t remainder, unsigned char *dst, unsigned char const *p, int nBytes)
+{
+    return (crcFoldPclmulBody (remainder, dst, p, nBytes, 1));
+}
+
+static int
+crcFoldSupported(void)
+{
+    __builtin_cpu_init ();
+    return (__builtin_cpu_supports ("sse2") && __builtin_cpu_supports ("pclmul"));
+}
+
+#define crcFold_	crcFoldPclmul
+#define crcFoldCopy_	crcFoldPclmulCopy
+#define CRC_FOLD_NAME	"pclmul"
+
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+
+#define FOLD(x, k)	veorq_u8 ( \
+        vreinterpretq_u8_p128 (vmull_p64 ( \
+            vgetq_lane_p64 (vreinterpretq_p64_u8 (x), 0), vgetq_lane_p64 ((k), 0))), \
+        vreinterpretq_u8_p128 (vmull_high_p64 (vreinterpretq_p64_u8 (x), (k))))
+#define FOLD_K(i)	vreinterpretq_p64_u64 (vld1q_u64 (crcFold[i]))
+
+__attribute__((target("+crypto")))
+CRC_BODY uint8x16_t
+crcLoad(unsigned char *dst, unsigned char const *p, int i, int const copy)
+{
+    uint8x16_t  v = vld1q_u8 (p + i);
+
+    if (copy)
+    {
+        vst1q_u8 (dst + i, v);
+    }
+    return (v);
+}
+
+__attribute__((target("+crypto")))
+CRC_BODY uint16_t
+crcFoldPmullBody(uint16_t remainder, unsigned char *dst,
+                 unsigned char const *p, int nBytes, int const copy)
+{
+    uint8x16_t      x0, x1, x2, x3;
+    poly64x2_t      k;
+    unsigned char   lane[16];
+    int             i = 0;
+
+    x0 = veorq_u8 (crcLoad (dst, p, i, copy),
+                   vreinterpretq_u8_u64 (vsetq_lane_u64 (remainder, vdupq_n_u64 (0), 0)));
+    if (nBytes >= 64)
+    {
+        x1 = crcLoad (dst, p, i + 16, copy);
+        x2 = crcLoad (dst, p, i + 32, copy);
+        x3 = crcLoad (dst, p, i + 48, copy);
+        i += 64;
+        nBytes -= 64;
+
+        k = FOLD_K(0);
+        while (nBytes >= 64)
+        {
+            x0 = veorq_u8 (FOLD(x0, k), crcLoad (dst, p, i, copy));
+            x1 = veorq_u8 (FOLD(x1, k), crcLoad (dst, p, i + 16, copy));
+            x2 = veorq_u8 (FOLD(x2, k), crcLoad (dst, p, i + 32, copy));
+            x3 = veorq_u8 (FOLD(x3, k), crcLoad (dst, p, i + 48, copy));
+            i += 64;
+            nBytes -= 64;
+        }
+
+        x0 = veorq_u8 (veorq_u8 (FOLD(x0, FOLD_K(1)), FOLD(x1, FOLD_K(2))),
+                       veorq_u8 (FOLD(x2, FOLD_K(3)), x3));
+    }
+    else
+    {
+        i += 16;
+        nBytes -= 16;
+    }
+
+    k = FOLD_K(3);
+    while (nBytes >= 16)
+    {
+        x0 = veorq_u8 (FOLD(x0, k), crcLoad (dst, p, i, copy));
+        i += 16;
+        nBytes -= 16;
+    }
+
+    vst1q_u8 (lane, x0);
+    return (crcSlice8Body (crcSlice8 (0, lane, 16),
+                           copy ? (dst + i) : NULL, p + i, nBytes, copy));
+
+}   /* crcFoldPmullBody() */
+
+__attribute__((target("+crypto")))
+static uint16_t
+crcFoldPmull(uint16_t remainder, unsigned char const *p, int nBytes)
+{
+    return (crcFoldPmullBody (remainder, NULL, p, nBytes, 0));
+}
+
+__attribute__((target("+crypto")))
+static uint16_t
+crcFoldPmullCopy(uint16_t remainder, unsigned char *dst, unsigned char const *p, int nBytes)
+{
+    return (crcFoldPmullBody (remainder, dst, p, nBytes, 1));
+}
+
+static int
+crcFoldSupported(void)
+{
+    return ((getauxval (AT_HWCAP) & HWCAP_PMULL) != 0);
+}
+
+#define crcFold_	crcFoldPmull
+#define crcFoldCopy_	crcFoldPmullCopy
+#define CRC_FOLD_NAME	"pmull"
+
+#endif
+
+
+/*
+ * The kernels for messages of CRC_FOLD_MIN bytes or more, picked by the
+ * first call.  Racing first calls store the same pointers.
+ */
+static uint16_t crcSelect(uint16_t remainder, unsigned char const *p, int nBytes);
+static uint16_t crcSelectCopy(uint16_t remainder, unsigned char *dst,
+                              unsigned char const *p, int nBytes);
+
+static uint16_t (*crcLong)(uint16_t, unsigned char const *, int) = crcSelect;
+static uint16_t (*crcLongCopy)(uint16_t, unsigned char *, unsigned char const *, int) = crcSelectCopy;
+
+static void
+crcResolve(void)
+{
+    uint16_t (*kernel)(uint16_t, unsigned char const *, int) = crcSlice8;
+    uint16_t (*kernelCopy)(uint16_t, unsigned char *, unsigned char const *, int) = crcSlice8Copy;
+
+#ifdef crcFold_
+    if (crcFoldSupported ())
+    {
+        kernel = crcFold_;
+        kernelCopy = crcFoldCopy_;
+    }
+#endif
+    __atomic_store_n (&crcLong, kernel, __ATOMIC_RELAXED);
+    __atomic_store_n (&crcLongCopy, kernelCopy, __ATOMIC_RELAXED);
+}
+
+static uint16_t
+crcSelect(uint16_t remainder, unsigned char const *p, int nBytes)
+{
+    crcResolve ();
+    return (__atomic_load_n (&crcLong, __ATOMIC_RELAXED) (remainder, p, nBytes));
+}
+
+static uint16_t
+crcSelectCopy(uint16_t remainder, unsigned char *dst, unsigned char const *p, int nBytes)
+{
+    crcResolve ();
+    return (__atomic_load_n (&crcLongCopy, __ATOMIC_RELAXED) (remainder, dst, p, nBytes));
+}
+
+
+/*********************************************************************
+ *
+ * Function:    crcFast()
+ * 
+ * Description: Compute the CRC of a given message.
+ *
+ * Notes:		Carry-less multiply folding where the CPU has it,
+ *				slicing-by-8 otherwise and for short messages.
+ *
+ * Returns:		The CRC of the message.
+ *
+ *********************************************************************/
+crc
+crcFast(unsigned char const message[], int nBytes)
+{
+    uint16_t    remainder;
+
+    if (nBytes >= CRC_FOLD_MIN)
+    {
+        remainder = __atomic_load_n (&crcLong, __ATOMIC_RELAXED) (INITIAL_REMAINDER, message, nBytes);
+    }
+    else
+    {
+        remainder = crcSlice8 (INITIAL_REMAINDER, message, nBytes);
+    }
+
+    /*
+     * The final remainder is the CRC.
+     */
+    return (remainder ^ FINAL_XOR_VALUE);
+
+}   /* crcFast() */
+
+
+/*********************************************************************
+ *
+ * Function:    crcFastUpdate()
+ * 
+ * Description: Continue a CRC from crcFast() over more of the message.
+ *
+ * Notes:		crcFastUpdate(crcFast(a, n), a + n, m) is
+ *				crcFast(a, n + m).
+ *
+ * Returns:		The CRC of the message so far.
+ *
+ *********************************************************************/
+crc
+crcFastUpdate(crc crcSoFar, unsigned char const message[], int nBytes)
+{
+    uint16_t    remainder = crcSoFar ^ FINAL_XOR_VALUE;
+
+    if (nBytes >= CRC_FOLD_MIN)
+    {
+        remainder = __atomic_load_n (&crcLong, __ATOMIC_RELAXED) (remainder, message, nBytes);
+    }
+    else
+    {
+        remainder = crcSlice8 (remainder, message, nBytes);
+    }
+    return (remainder ^ FINAL_XOR_VALUE);
+
+}   /* crcFastUpdate() */
+
+
+/*
+ * crcMulModP() - a * b modulo the polynomial, both bit-reflected
+ */
+static uint16_t
+crcMulModP(uint16_t a, uint16_t b)
+{
+    uint16_t    m = 1 << (WIDTH - 1);       // x^0
+    uint16_t    p = 0;
+
+    for (;;)
+    {
+        if (a & m)
+        {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+            {
+                break;
+            }
+        }
+        m >>= 1;
+        b = (b & 1) ? ((b >> 1) ^ CRC_POLY_REFLECTED) : (b >> 1);
+    }
+    return (p);
+}
+
+
+/*********************************************************************
+ *
+ * Function:    crcCombine()
+ * 
+ * Description: Compute the CRC of two messages back to back, from
+ *				the CRC of each one and the length of the second.
+ *
+ * Notes:		With a zero INITIAL_REMAINDER and FINAL_XOR_VALUE the
+ *				CRC is linear: the first CRC is shifted over nBytes2
+ *				zero bytes, a product with x^(8 * nBytes2) built from
+ *				the powers of crc_table.h; a single product for the
+ *				lengths of WOU frames.
+ *
+ * Returns:		The CRC of the two messages.
+ *
+ *********************************************************************/
+crc
+crcCombine(crc crc1, crc crc2, int nBytes2)
+{
+    uint16_t    xn;
+    int         k;
+
+    // x^(8 * nBytes2), a byte of nBytes2 at a time
+    xn = crcX8n[nBytes2 & (CRC_X8N - 1)];
+    nBytes2 >>= 8;
+    k = 3 + 8;
+    while (nBytes2 > 0)
+    {
+        if (nBytes2 & 1)
+        {
+            xn = crcMulModP (crcX2n[k % CRC_X2N], xn);
+        }
+        nBytes2 >>= 1;
+        k++;
+    }
+    return (crcMulModP (xn, crc1) ^ crc2);
+
+}   /* crcCombine() */
+
+
+/*********************************************************************
+ *
+ * Function:    crcFastCopy()
+ * 
+ * Description: Copy a part of a message and continue its CRC, in one
+ *				pass over the bytes.
+ *
+ * Notes:		The same as memcpy(dst, message, nBytes) followed by
+ *				crcFastUpdate(crcSoFar, dst, nBytes).  @dst and
+ *				@message must not overlap.
+ *
+ * Returns:		The CRC of the message so far.
+ *
+ *********************************************************************/
+crc
+crcFastCopy(crc crcSoFar, unsigned char dst[], unsigned char const message[], int nBytes)
+{
+    uint16_t    remainder = crcSoFar ^ FINAL_XOR_VALUE;
+
+    if (nBytes >= CRC_FOLD_MIN)
+    {
+        remainder = __atomic_load_n (&crcLongCopy, __ATOMIC_RELAXED) (remainder, dst, message, nBytes);
+    }
+    else
+    {
+        remainder = crcSlice8Copy (remainder, dst, message, nBytes);
+    }
+    return (remainder ^ FINAL_XOR_VALUE);
+
+}   /* crcFastCopy() */
+
+
+/*********************************************************************
+ *
+ * Function:    crcSliced()
+ * 
+ * Description: Compute the CRC of a given message, portably.
+ *
+ * Notes:		Slicing-by-8 on every CPU; the reference of crcFast().
+ *
+ * Returns:		The CRC of the message.
+ *
+ *********************************************************************/
+crc
+crcSliced(unsigned char const message[], int nBytes)
+{
+    return (crcSlice8 (INITIAL_REMAINDER, message, nBytes) ^ FINAL_XOR_VALUE);
+
+}   /* crcSliced() */
+
+
+/*********************************************************************
+ *
+ * Function:    crcKernel()
+ * 
+ * Description: Name the kernel crcFast() uses for long messages.
+ *
+ * Notes:		
+ *
+ * Returns:		"pclmul", "pmull" or "slice8".
+ *
+ *********************************************************************/
+char const *
+crcKernel(void)
+{
+#ifdef crcFold_
+    if (crcFoldSupported ())
+    {
+        return (CRC_FOLD_NAME);
+    }
+#endif
+    return ("slice8");
+
+}   /* crcKernel() */
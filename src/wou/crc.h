@@ -76,6 +76,11 @@ typedef unsigned long  crc;
 void  crcInit(void);
 crc   crcSlow(unsigned char const message[], int nBytes);
 crc   crcFast(unsigned char const message[], int nBytes);
+crc   crcSliced(unsigned char const message[], int nBytes);
+crc   crcFastUpdate(crc crcSoFar, unsigned char const message[], int nBytes);
+crc   crcCombine(crc crc1, crc crc2, int nBytes2);
+crc   crcFastCopy(crc crcSoFar, unsigned char dst[], unsigned char const message[], int nBytes);
+char const *crcKernel(void);
 
 
 #endif /* _crc_h */
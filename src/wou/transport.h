@@ -0,0 +1,72 @@
+#ifndef __TRANSPORT_H__
+#define __TRANSPORT_H__
+
+/**
+ * transport.h - link layer underneath the WOU protocol engine
+ *
+ * board.c talks to the device only through a wou_transport_t, which is
+ * picked from board_table[] at board_init() time.  The GBN engine
+ * (wou_send, wou_recv, wou_eof ...) never calls libftdi/libusb directly.
+ **/
+
+struct board;
+
+// direction argument for wou_transport_t.poll()
+#define XFER_ANY    0       // pump pending events only
+#define XFER_TX     1
+#define XFER_RX     2
+
+// return values of wou_transport_t.poll(), besides the transferred size
+#define XFER_IDLE   (-1)    // there is no outstanding transfer
+#define XFER_BUSY   (-2)    // the outstanding transfer is still in flight
+
+/**
+ * wou_transport_t - operations of a link backend
+ * @name:       name of the backend
+ * @open:       open and configure the device; returns 0 on success
+ * @connected:  non-zero if the device is attached
+ * @submit_tx:  issue an async write of @size bytes; returns 0 on success
+ *              @buf must stay untouched until the transfer completes.
+ *              up to TX_XFER_DEPTH writes may be outstanding
+ * @submit_rx:  issue an async read of up to @size bytes into @buf;
+ *              returns 0 on success.  one read request at a time; the
+ *              backend may keep more transfers in flight behind it
+ * @poll:       handle pending events without blocking.
+ *              XFER_TX/XFER_RX: returns XFER_IDLE, XFER_BUSY, or the size
+ *              of the completed transfer (0 for a failed transfer).
+ *              writes complete in the order of submission
+ *              XFER_ANY: returns 0, or -1 on error
+ * @rx_pending: bytes already buffered by the backend, ready to be read
+ * @wait:       block until a transfer completes or @usec passes, then
+ *              handle the pending events; returns 0, or -1 on error
+ * @write:      blocking write, for configuring the FPGA;
+ *              returns bytes written or a negative error code
+ * @reset:      drop data buffered at host side; also purge the device
+ *              FIFOs if @purge is set.  returns 0 on success
+ * @close:      close the device; returns 0 on success
+ **/
+typedef struct wou_transport {
+    const char  *name;
+    int         (*open)       (struct board *b);
+    int         (*connected)  (struct board *b);
+    int         (*submit_tx)  (struct board *b, const uint8_t *buf, int size);
+    int         (*submit_rx)  (struct board *b, uint8_t *buf, int size);
+    int         (*poll)       (struct board *b, int dir);
+    int         (*rx_pending) (struct board *b);
+    int         (*wait)       (struct board *b, int usec);
+    int         (*write)      (struct board *b, const uint8_t *buf, int size);
+    int         (*reset)      (struct board *b, int purge);
+    int         (*close)      (struct board *b);
+} wou_transport_t;
+
+// libftdi (async mode) backend, transport_ftdi.c
+extern const wou_transport_t ftdi_transport;
+
+// in-process FPGA emulator backend, transport_emu.c
+extern const wou_transport_t emu_transport;
+void emu_set_faults (struct board *b, uint32_t drop_ppm, uint32_t crc_ppm);
+void emu_set_write_time (struct board *b, uint32_t nsec);
+int emu_inject (struct board *b, const uint8_t *buf, int size);
+const uint8_t *emu_wb_ptr (struct board *b);
+
+#endif  // __TRANSPORT_H__
@@ -0,0 +1,634 @@
+/**
+ * transport_emu.c - in-process emulator of the 7i43u FPGA side of WOU
+ *
+ * Stands in for the FTDI link plus the FPGA, so that the protocol engine
+ * of board.c can be exercised and profiled without a board:
+ *  - parses TYP_WOUF/RT_WOUF/RST_TID frames and checks their CRC16
+ *  - keeps the expected TID and answers with ACK/NAK frames which carry
+ *    the payload of the WB_RD_CMD packets
+ *  - agrees to SELECTIVE-REPEAT on ARQ_SR: holds the TYP_WOUFs after a
+ *    missing one, runs them in order once it arrives, and answers with
+ *    SACK_WOUF frames instead of NAK
+ *  - applies WB_WR_CMD packets to a simulated 64 KB wishbone space
+ *  - emits a MAILBOX frame for every base period (0.65535 ms)
+ *  - completes writes at once, or one per emu_set_write_time() in a row
+ *
+ * Select it with wou_init(&w_param, "7i43u-emu", 0, NULL).
+ *
+ * Copyright (C) 2009 Yishin Li <ysli@araisrobo.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General
+ * Public License as published by the Free Software Foundation.
+ **/
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/param.h>  // for MIN() and MAX()
+
+#include <libusb.h>
+#include <ftdi.h>
+
+#include "wb_regs.h"
+#include "mailtag.h"
+#include "wou.h"
+#include "board.h"
+#include "transport.h"
+#include "crc.h"
+
+// to disable DP(): #define TRACE 1
+#define TRACE 0
+#include "dptrace.h"
+#if (TRACE!=0)
+#define dptrace stderr
+#endif
+
+#define EMU_BP_NSEC     655350                  // base period: 0.65535ms
+#define EMU_MAX_BP      32                      // max mails to catch up after a host stall
+#define EMU_IN_SIZE     8192                    // host -> fpga parsing buffer
+#define EMU_OUT_SIZE    65536                   // fpga -> host FIFO, must be power of 2
+#define EMU_OUT_MASK    (EMU_OUT_SIZE - 1)
+#define EMU_FSIZE_MAX   (WOUF_HDR_SIZE + MAX_PSIZE + CRC_SIZE)
+
+/**
+ * emu_t - state of the emulated FPGA
+ * @wb:         simulated wishbone space
+ * @tid:        expected TID of the next TYP_WOUF
+ * @arq:        ARQ mode agreed with host, WOU_ARQ_GBN or WOU_ARQ_SR
+ * @held:       TYP_WOUFs received ahead of @tid, by TID modulo NR_OF_WIN
+ * @held_map:   bit (TID % NR_OF_WIN) is set for a frame in @held
+ * @reconfig:   set after GPIO_RECONFIG; bytes from host are bitstream
+ * @in:         bytes from host which are not parsed yet
+ * @out:        circular FIFO of bytes to host
+ * @tx_done:    sizes of the submitted writes, oldest first
+ * @tx_due:     completion time of each write in @tx_done, in ns
+ * @tx_cnt:     number of entries in @tx_done
+ * @write_nsec: USB time of a write, 0 to complete it at submission
+ * @rx_buf:     buffer of the submitted read, NULL for none
+ * @bp_begin:   time of bp_tick 0
+ * @bp_tick:    number of base periods with a mail sent
+ * @seed:       rand_r() seed for fault injection
+ * @drop_ppm:   rate of dropping a frame from host, in ppm
+ * @crc_ppm:    rate of corrupting a frame to host, in ppm
+ **/
+typedef struct emu {
+    uint8_t     wb[WB_REG_SIZE];
+    uint8_t     tid;
+    int         arq;
+    uint8_t     held[NR_OF_WIN][EMU_FSIZE_MAX];
+    uint64_t    held_map;
+    int         reconfig;
+    uint8_t     in[EMU_IN_SIZE];
+    int         in_size;
+    uint8_t     out[EMU_OUT_SIZE];
+    uint32_t    out_head;
+    uint32_t    out_tail;
+    int         tx_done[TX_XFER_DEPTH];
+    int64_t     tx_due[TX_XFER_DEPTH];
+    int         tx_cnt;
+    uint32_t    write_nsec;
+    uint8_t     *rx_buf;
+    int         rx_req;
+    struct timespec bp_begin;
+    uint32_t    bp_tick;
+    unsigned int seed;
+    uint32_t    drop_ppm;
+    uint32_t    crc_ppm;
+} emu_t;
+
+static int64_t emu_ns (void)
+{
+    struct timespec t;
+
+    clock_gettime (CLOCK_MONOTONIC, &t);
+    return ((int64_t) t.tv_sec * 1000000000LL + t.tv_nsec);
+}
+
+static int emu_fault (emu_t *emu, uint32_t ppm)
+{
+    if (ppm == 0) return 0;
+    return ((uint32_t) (rand_r(&emu->seed) % 1000000) < ppm);
+}
+
+static uint32_t emu_out_size (emu_t *emu)
+{
+    return (emu->out_tail - emu->out_head);
+}
+
+/**
+ * emu_reply - queue a WOU_FRAME to host
+ * @frame: the frame starting from PLOAD_SIZE_TX, without CRC
+ **/
+static void emu_reply (emu_t *emu, uint8_t *frame)
+{
+    uint8_t     hdr[WOUF_HDR_SIZE - 1] = {WOUF_PREAMBLE, WOUF_PREAMBLE, WOUF_SOFD};
+    uint16_t    crc16;
+    int         size;
+    int         flip;
+    int         i;
+
+    size = 1 + frame[0];
+    crc16 = crcFast (frame, size);
+    memcpy (frame + size, &crc16, CRC_SIZE);
+    // corrupt the copy on the wire only; @frame may be sent again
+    flip = -1;
+    if (emu_fault (emu, emu->crc_ppm)) {
+        flip = 1 + rand_r(&emu->seed) % (size + 1);
+    }
+    if ((emu_out_size (emu) + sizeof(hdr) + size + CRC_SIZE) > EMU_OUT_SIZE) {
+        // FIFO to host overflows if host stops reading
+        DP ("drop reply, out_size(%u)\n", emu_out_size (emu));
+        return;
+    }
+    for (i = 0; i < sizeof(hdr); i++) {
+        emu->out[emu->out_tail++ & EMU_OUT_MASK] = hdr[i];
+    }
+    for (i = 0; i < (size + CRC_SIZE); i++) {
+        emu->out[emu->out_tail++ & EMU_OUT_MASK] = (i == flip) ? (frame[i] ^ 0x10) : frame[i];
+    }
+}
+
+/**
+ * emu_exec - run [WOU][WOU]... packets against the wishbone space
+ * @pkt:    first [WOU] packet
+ * @size:   size of all packets
+ * @rsp:    append read data here as [DSIZE][WB_ADDR][DATA]
+ * returns: size of appended read data
+ **/
+static int emu_exec (emu_t *emu, const uint8_t *pkt, int size, uint8_t *rsp)
+{
+    uint8_t     func;
+    uint8_t     dsize;
+    uint16_t    wb_addr;
+    int         rsp_size;
+
+    rsp_size = 0;
+    while (size >= WOU_HDR_SIZE) {
+        func = pkt[0] & WB_WR_CMD;
+        dsize = pkt[0] & 0x7F;
+        memcpy (&wb_addr, pkt + 1, WB_ADDR_SIZE);
+        pkt += WOU_HDR_SIZE;
+        size -= WOU_HDR_SIZE;
+        if (func == WB_WR_CMD) {
+            assert (dsize <= size);
+            memcpy (emu->wb + wb_addr, pkt, MIN(dsize, WB_REG_SIZE - wb_addr));
+            if ((wb_addr == (GPIO_BASE | GPIO_SYSTEM)) && (pkt[0] & GPIO_RECONFIG)) {
+                DP ("GPIO_RECONFIG\n");
+                emu->reconfig = 1;
+            }
+            pkt += dsize;
+            size -= dsize;
+        } else {
+            rsp[rsp_size] = dsize;
+            memcpy (rsp + rsp_size + 1, &wb_addr, WB_ADDR_SIZE);
+            memcpy (rsp + rsp_size + WOU_HDR_SIZE, emu->wb + wb_addr,
+                    MIN(dsize, WB_REG_SIZE - wb_addr));
+            rsp_size += WOU_HDR_SIZE + dsize;
+        }
+    }
+    assert (size == 0);
+    return (rsp_size);
+}
+
+/**
+ * emu_wouf - run the TYP_WOUF of the expected TID, and ACK it
+ * @buf: the frame starting from PLOAD_SIZE_TX, CRC checked
+ **/
+static void emu_wouf (emu_t *emu, const uint8_t *buf)
+{
+    uint8_t     rsp[EMU_FSIZE_MAX];
+    int         rsp_size;
+
+    // {PLOAD_SIZE_TX, TYP_WOUF, TID, PLOAD_SIZE_RX, [WOU]...}
+    rsp_size = emu_exec (emu, buf + 4, buf[0] - 3, rsp + 3);
+    emu->tid += 1;
+    rsp[0] = 2 + rsp_size;
+    rsp[1] = TYP_WOUF;
+    rsp[2] = emu->tid;
+    assert (rsp[0] == buf[3]);  // PLOAD_SIZE_RX
+    emu_reply (emu, rsp);
+}
+
+/**
+ * emu_sack - report the expected TID, and the frames held after it
+ **/
+static void emu_sack (emu_t *emu)
+{
+    uint8_t     rsp[EMU_FSIZE_MAX];
+    uint64_t    held;
+    int         i;
+
+    // {PLOAD_SIZE_TX, SACK_WOUF, TID, BITMAP[8]}: bit i for TID + 1 + i
+    held = 0;
+    for (i = 0; i < SACK_BITS; i++) {
+        if (emu->held_map & (1ULL << ((emu->tid + 1 + i) % NR_OF_WIN))) {
+            held |= 1ULL << i;
+        }
+    }
+    rsp[0] = 2 + sizeof(held);
+    rsp[1] = SACK_WOUF;
+    rsp[2] = emu->tid;
+    memcpy (rsp + 3, &held, sizeof(held));
+    emu_reply (emu, rsp);
+}
+
+/**
+ * emu_frame - process a WOU_FRAME from host
+ * @buf: the frame starting from PLOAD_SIZE_TX, CRC checked
+ **/
+static void emu_frame (emu_t *emu, const uint8_t *buf)
+{
+    uint8_t     rsp[EMU_FSIZE_MAX];
+    uint8_t     ahead;
+    int         pload_size_tx;
+    int         rsp_size;
+    int         slot;
+
+    pload_size_tx = buf[0];
+    switch (buf[1]) {
+    case TYP_WOUF:
+        ahead = buf[2] - emu->tid;
+        if (ahead == 0) {
+            emu_wouf (emu, buf);
+            // SELECTIVE-REPEAT: run the frames held behind it
+            while (emu->held_map & (1ULL << (emu->tid % NR_OF_WIN))) {
+                slot = emu->tid % NR_OF_WIN;
+                emu->held_map &= ~(1ULL << slot);
+                emu_wouf (emu, emu->held[slot]);
+            }
+        } else if (emu->arq == WOU_ARQ_SR) {
+            if (ahead < NR_OF_WIN) {
+                // hold it until the missing ones arrive
+                slot = buf[2] % NR_OF_WIN;
+                memcpy (emu->held[slot], buf, 1 + pload_size_tx);
+                emu->held_map |= 1ULL << slot;
+            }
+            DP ("SACK tid(0x%02X) expected(0x%02X)\n", buf[2], emu->tid);
+            emu_sack (emu);
+        } else {
+            // NAK: report the expected TID only
+            DP ("NAK tid(0x%02X) expected(0x%02X)\n", buf[2], emu->tid);
+            rsp[0] = 2;
+            rsp[1] = TYP_WOUF;
+            rsp[2] = emu->tid;
+            emu_reply (emu, rsp);
+        }
+        break;
+
+    case RST_TID:
+        // reset the expected TID; no response
+        emu->tid = buf[2] + 1;
+        emu->held_map = 0;
+        break;
+
+    case ARQ_SR:
+        // {PLOAD_SIZE_TX, ARQ_SR, WINDOW}: agree to it
+        assert (buf[2] <= NR_OF_WIN);
+        emu->arq = WOU_ARQ_SR;
+        rsp[0] = 2;
+        rsp[1] = ARQ_SR;
+        rsp[2] = buf[2];
+        emu_reply (emu, rsp);
+        break;
+
+    case RT_WOUF:
+        // {PLOAD_SIZE_TX, RT_WOUF, PLOAD_SIZE_RX, [WOU]...}
+        rsp_size = emu_exec (emu, buf + 3, pload_size_tx - 2, rsp + 2);
+        rsp[0] = 1 + rsp_size;
+        rsp[1] = RT_WOUF;
+        assert (rsp[0] == buf[2]);  // PLOAD_SIZE_RX
+        emu_reply (emu, rsp);
+        break;
+
+    default:
+        DP ("unknown WOUF_COMMAND(0x%02X)\n", buf[1]);
+        break;
+    }
+}
+
+// parse bytes from host like the WOU receiver of the FPGA
+static void emu_parse (emu_t *emu)
+{
+    uint8_t     *buf;
+    int         size;
+    int         fsize;
+    uint16_t    crc16;
+
+    buf = emu->in;
+    size = emu->in_size;
+    while (size >= (WOUF_HDR_SIZE + 1 + CRC_SIZE)) {
+        if ((buf[0] != WOUF_PREAMBLE) || (buf[1] != WOUF_PREAMBLE)
+            || (buf[2] != WOUF_SOFD) || (buf[3] == 0)) {
+            buf++;
+            size--;
+            continue;
+        }
+        fsize = WOUF_HDR_SIZE + buf[3] + CRC_SIZE;
+        if (fsize > size) {
+            break;  // wait for the rest of this frame
+        }
+        crc16 = crcFast (buf + WOUF_HDR_SIZE - 1, 1 + buf[3]);
+        if (memcmp (buf + WOUF_HDR_SIZE + buf[3], &crc16, CRC_SIZE) != 0) {
+            DP ("CRC ERROR\n");
+            buf++;
+            size--;
+            continue;
+        }
+        if (!emu_fault (emu, emu->drop_ppm)) {
+            emu_frame (emu, buf + WOUF_HDR_SIZE - 1);
+        }
+        buf += fsize;
+        size -= fsize;
+    }
+    if (size) {
+        memmove (emu->in, buf, size);
+    }
+    emu->in_size = size;
+}
+
+// power-up state of the FPGA
+static void emu_power_up (emu_t *emu)
+{
+    memset (emu->wb, 0, WB_REG_SIZE);
+    emu->tid = 0xFF;    // TID of the first WOUF after gbn_init()
+    emu->arq = WOU_ARQ_GBN;
+    emu->held_map = 0;
+    emu->reconfig = 0;
+    emu->in_size = 0;
+    emu->out_head = 0;
+    emu->out_tail = 0;
+    emu->bp_tick = 0;
+    clock_gettime (CLOCK_MONOTONIC, &emu->bp_begin);
+}
+
+// feed bytes from host
+static void emu_input (emu_t *emu, const uint8_t *buf, int size)
+{
+    int n;
+
+    while (size > 0) {
+        n = MIN(size, EMU_IN_SIZE - emu->in_size);
+        memcpy (emu->in + emu->in_size, buf, n);
+        emu->in_size += n;
+        buf += n;
+        size -= n;
+        emu_parse (emu);
+        if (emu->in_size == EMU_IN_SIZE) {
+            // no SYNC word in a full buffer
+            emu->in_size = 0;
+        }
+    }
+}
+
+// queue a MAILBOX frame for every elapsed base period
+static void emu_mailbox (emu_t *emu)
+{
+    struct timespec now;
+    uint64_t        ns;
+    uint64_t        ticks;
+    uint8_t         mail[EMU_FSIZE_MAX];
+    uint16_t        mail_tag;
+
+    if (emu->reconfig) return;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    ns = (uint64_t) (now.tv_sec - emu->bp_begin.tv_sec) * 1000000000ULL
+         + now.tv_nsec - emu->bp_begin.tv_nsec;
+    ticks = ns / EMU_BP_NSEC;
+    if ((ticks - emu->bp_tick) > EMU_MAX_BP) {
+        // the FPGA kept sending while the host was stalled; those are lost
+        emu->bp_tick = ticks - EMU_MAX_BP;
+    }
+
+    // {PLOAD_SIZE_TX, MAILBOX, MAIL_TAG, BP_TICK, DEBUG[8]}
+    memset (mail, 0, sizeof(mail));
+    mail[0] = 1 + sizeof(uint16_t) + 9 * sizeof(uint32_t);
+    mail[1] = MAILBOX;
+    mail_tag = MT_DEBUG;
+    memcpy (mail + 2, &mail_tag, sizeof(uint16_t));
+    while (emu->bp_tick < ticks) {
+        emu->bp_tick ++;
+        memcpy (mail + 4, &emu->bp_tick, sizeof(uint32_t));
+        emu_reply (emu, mail);
+    }
+}
+
+static int emu_xport_open (board_t* b)
+{
+    emu_t   *emu;
+
+    emu = (emu_t *) malloc (sizeof(emu_t));
+    if (emu == NULL) {
+        ERRP ("malloc(emu_t) failed\n");
+        return EXIT_FAILURE;
+    }
+    emu_power_up (emu);
+    emu->tx_cnt = 0;
+    emu->write_nsec = 0;
+    emu->rx_buf = NULL;
+    emu->seed = 1;
+    emu->drop_ppm = 0;
+    emu->crc_ppm = 0;
+    b->xport_data = emu;
+    return 0;
+}
+
+static int emu_xport_connected (board_t* b)
+{
+    return (b->xport_data != NULL);
+}
+
+static int emu_xport_submit_tx (board_t* b, const uint8_t *buf, int size)
+{
+    emu_t   *emu = b->xport_data;
+    int64_t due;
+
+    assert (emu->tx_cnt < TX_XFER_DEPTH);
+    if (emu->reconfig) {
+        // async traffic resumes once the bitstream is loaded
+        emu_power_up (emu);
+    }
+    // the FPGA takes the bytes at once; the write completes after the
+    // writes before it, one write_nsec each
+    emu_input (emu, buf, size);
+    due = emu_ns ();
+    if (emu->tx_cnt) {
+        due = MAX(due, emu->tx_due[emu->tx_cnt - 1]);
+    }
+    emu->tx_done[emu->tx_cnt] = size;
+    emu->tx_due[emu->tx_cnt] = due + emu->write_nsec;
+    emu->tx_cnt ++;
+    return 0;
+}
+
+static int emu_xport_submit_rx (board_t* b, uint8_t *buf, int size)
+{
+    emu_t   *emu = b->xport_data;
+
+    assert (emu->rx_buf == NULL);
+    emu->rx_buf = buf;
+    emu->rx_req = size;
+    return 0;
+}
+
+static int emu_xport_poll (board_t* b, int dir)
+{
+    emu_t       *emu = b->xport_data;
+    int         n;
+    int         i;
+
+    emu_mailbox (emu);
+
+    if (dir == XFER_TX) {
+        if (emu->tx_cnt == 0) return XFER_IDLE;
+        if (emu->write_nsec && (emu_ns () < emu->tx_due[0])) return XFER_BUSY;
+        n = emu->tx_done[0];
+        emu->tx_cnt --;
+        memmove (emu->tx_done, emu->tx_done + 1, emu->tx_cnt * sizeof(int));
+        memmove (emu->tx_due, emu->tx_due + 1, emu->tx_cnt * sizeof(int64_t));
+        return n;
+    } else if (dir == XFER_RX) {
+        if (emu->rx_buf == NULL) return XFER_IDLE;
+        n = MIN(emu->rx_req, emu_out_size (emu));
+        if (n == 0) return XFER_BUSY;
+        i = MIN(n, EMU_OUT_SIZE - (emu->out_head & EMU_OUT_MASK));
+        memcpy (emu->rx_buf, emu->out + (emu->out_head & EMU_OUT_MASK), i);
+        memcpy (emu->rx_buf + i, emu->out, n - i);
+        emu->out_head += n;
+        emu->rx_buf = NULL;
+        return n;
+    }
+    return 0;
+}
+
+static int emu_xport_rx_pending (board_t* b)
+{
+    emu_t   *emu = b->xport_data;
+
+    return (MIN(emu_out_size (emu), b->cfg.rx_chunk_size));
+}
+
+static int emu_xport_wait (board_t* b, int usec)
+{
+    emu_t           *emu = b->xport_data;
+    struct timespec treq;
+    int64_t         nsec;
+
+    // a read completes with data to host; a write at its due time
+    nsec = (int64_t) usec * 1000;
+    if (emu->tx_cnt > 0) {
+        nsec = MIN(nsec, emu->tx_due[0] - emu_ns ());
+    }
+    if ((nsec <= 0) || ((emu->rx_buf != NULL) && (emu_out_size (emu) > 0))) {
+        return 0;
+    }
+    treq.tv_sec = 0;
+    treq.tv_nsec = nsec;
+    nanosleep (&treq, NULL);
+    emu_mailbox (b->xport_data);
+    return 0;
+}
+
+static int emu_xport_write (board_t* b, const uint8_t *buf, int size)
+{
+    emu_t   *emu = b->xport_data;
+
+    if (!emu->reconfig) {
+        emu_input (emu, buf, size);
+    }
+    // else: swallow the bitstream
+    return size;
+}
+
+static int emu_xport_reset (board_t* b, int purge)
+{
+    emu_t   *emu = b->xport_data;
+
+    if (purge) {
+        emu->in_size = 0;
+        emu->out_head = emu->out_tail;
+    }
+    return 0;
+}
+
+static int emu_xport_close (board_t* b)
+{
+    free (b->xport_data);
+    b->xport_data = NULL;
+    return 0;
+}
+
+/**
+ * emu_set_faults - inject link errors
+ * @drop_ppm:   rate of frames from host lost before the FPGA, in ppm
+ * @crc_ppm:    rate of frames to host getting a CRC error, in ppm
+ **/
+void emu_set_faults (board_t* b, uint32_t drop_ppm, uint32_t crc_ppm)
+{
+    emu_t   *emu = b->xport_data;
+
+    assert (b->xport == &emu_transport);
+    emu->drop_ppm = drop_ppm;
+    emu->crc_ppm = crc_ppm;
+}
+
+/**
+ * emu_set_write_time - model the USB time of a write
+ * @nsec:   time of a write; writes in flight complete one after another
+ **/
+void emu_set_write_time (board_t* b, uint32_t nsec)
+{
+    emu_t   *emu = b->xport_data;
+
+    assert (b->xport == &emu_transport);
+    emu->write_nsec = nsec;
+}
+
+/**
+ * emu_inject - queue raw bytes to host, as if the FPGA sent them
+ * returns: number of bytes queued
+ **/
+int emu_inject (board_t* b, const uint8_t *buf, int size)
+{
+    emu_t       *emu = b->xport_data;
+    int         i;
+
+    assert (b->xport == &emu_transport);
+    size = MIN(size, (int) (EMU_OUT_SIZE - emu_out_size (emu)));
+    i = MIN(size, EMU_OUT_SIZE - (emu->out_tail & EMU_OUT_MASK));
+    memcpy (emu->out + (emu->out_tail & EMU_OUT_MASK), buf, i);
+    memcpy (emu->out, buf + i, size - i);
+    emu->out_tail += size;
+    return size;
+}
+
+/**
+ * emu_wb_ptr - the simulated wishbone space of the FPGA
+ **/
+const uint8_t *emu_wb_ptr (board_t* b)
+{
+    emu_t   *emu = b->xport_data;
+
+    assert (b->xport == &emu_transport);
+    return (emu->wb);
+}
+
+const wou_transport_t emu_transport = {
+    .name       = "emu",
+    .open       = emu_xport_open,
+    .connected  = emu_xport_connected,
+    .submit_tx  = emu_xport_submit_tx,
+    .submit_rx  = emu_xport_submit_rx,
+    .poll       = emu_xport_poll,
+    .rx_pending = emu_xport_rx_pending,
+    .wait       = emu_xport_wait,
+    .write      = emu_xport_write,
+    .reset      = emu_xport_reset,
+    .close      = emu_xport_close
+};
+
+// vim:sw=4:sts=4:et:
@@ -0,0 +1,507 @@
+/**
+ * transport_ftdi.c - libftdi (async mode) backend of the WOU link
+ *
+ * Up to TX_XFER_DEPTH writes are queued with ftdi_write_data_submit().
+ * Reads bypass ftdi_read_data_submit(), which shares one readbuffer among
+ * all transfers: RX_XFER_DEPTH bulk-in transfers are kept in flight on the
+ * FTDI endpoint, and their payload, without the 2 modem status bytes of
+ * every packet, is handed to the pending read request in order.
+ *
+ * The boards of a group share one libusb context, see board_group_add().
+ *
+ * Copyright (C) 2009 Yishin Li <ysli@araisrobo.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General
+ * Public License as published by the Free Software Foundation.
+ **/
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/param.h>  // for MIN() and MAX()
+
+#include <libusb.h>
+#include <ftdi.h>       // from FTDI
+
+#include "wb_regs.h"
+#include "wou.h"
+#include "board.h"
+#include "transport.h"
+
+// to disable DP(): #define TRACE 1
+#define TRACE 0
+#include "dptrace.h"
+#if (TRACE!=0)
+#define dptrace stderr
+#endif
+
+// states of rx_xfer[]
+enum {
+    RX_PENDING = 0,     // submitted to libusb
+    RX_DONE,            // completed, with status bytes
+    RX_READY,           // payload in rx_len[]
+    RX_IDLE             // not submitted
+};
+
+static void LIBUSB_CALL ftdi_xport_rx_cb (struct libusb_transfer *transfer)
+{
+    *((int *) transfer->user_data) = RX_DONE;
+}
+
+// (re-)submit the bulk-in transfer rx_xfer[i]
+static void ftdi_rx_submit (board_t* b, int i)
+{
+    int ret;
+
+    b->io.usb.rx_state[i] = RX_PENDING;
+    b->io.usb.rx_len[i] = 0;
+    if ((ret = libusb_submit_transfer (b->io.usb.rx_xfer[i])) < 0) {
+        ERRP ("libusb_submit_transfer(): %d\n", ret);
+        b->io.usb.rx_state[i] = RX_IDLE;
+    }
+}
+
+// drop the FTDI modem status bytes at the start of every packet
+static int ftdi_rx_strip (uint8_t *buf, int len, int packet_size)
+{
+    int in, out, n;
+
+    out = 0;
+    for (in = 0; in < len; in += packet_size) {
+        n = MIN(packet_size, len - in) - 2;
+        if (n <= 0) continue;
+        memmove (buf + out, buf + in + 2, n);
+        out += n;
+    }
+    return out;
+}
+
+/**
+ * ftdi_rx_ready - bytes received in order from rx_xfer[rx_head]
+ **/
+static int ftdi_rx_ready (board_t* b)
+{
+    struct libusb_transfer  *xfer;
+    int                     ready;
+    int                     i, n;
+
+    ready = 0;
+    for (n = 0; n < RX_XFER_DEPTH; n++) {
+        i = (b->io.usb.rx_head + n) % RX_XFER_DEPTH;
+        if (b->io.usb.rx_state[i] == RX_DONE) {
+            xfer = b->io.usb.rx_xfer[i];
+            if ((xfer->status == LIBUSB_TRANSFER_COMPLETED)
+                || (xfer->status == LIBUSB_TRANSFER_TIMED_OUT)) {
+                b->io.usb.rx_len[i] = ftdi_rx_strip (xfer->buffer, xfer->actual_length,
+                                                     b->io.usb.ftdic.max_packet_size);
+            } else {
+                DP ("rx_xfer[%d] status(%d)\n", i, xfer->status);
+                b->io.usb.rx_len[i] = 0;
+            }
+            b->io.usb.rx_state[i] = RX_READY;
+        }
+        if (b->io.usb.rx_state[i] == RX_PENDING) break;
+        ready += b->io.usb.rx_len[i];
+    }
+    return (ready - b->io.usb.rx_offset);
+}
+
+/**
+ * ftdi_rx_copy - move up to @size received bytes to @buf, in order,
+ *                and put drained transfers back in flight
+ **/
+static int ftdi_rx_copy (board_t* b, uint8_t *buf, int size)
+{
+    int i, n, got;
+
+    ftdi_rx_ready (b);
+    got = 0;
+    for (;;) {
+        i = b->io.usb.rx_head;
+        if (b->io.usb.rx_state[i] == RX_PENDING) break;
+        if (b->io.usb.rx_state[i] == RX_READY) {
+            n = MIN(b->io.usb.rx_len[i] - b->io.usb.rx_offset, size - got);
+            if (buf) {
+                memcpy (buf + got, b->io.usb.rx_xfer[i]->buffer + b->io.usb.rx_offset, n);
+            }
+            b->io.usb.rx_offset += n;
+            got += n;
+            if (b->io.usb.rx_offset < b->io.usb.rx_len[i]) break;  // buf is full
+        }
+        // rx_xfer[i] is drained
+        ftdi_rx_submit (b, i);
+        b->io.usb.rx_head = (i + 1) % RX_XFER_DEPTH;
+        b->io.usb.rx_offset = 0;
+        if (got == size) break;
+    }
+    return got;
+}
+
+// drop received bytes
+static void ftdi_rx_drop (board_t* b)
+{
+    while (ftdi_rx_ready (b) > 0) {
+        ftdi_rx_copy (b, NULL, b->cfg.rx_chunk_size);
+    }
+}
+
+static int ftdi_xport_close (board_t* b);
+
+/**
+ * ftdi_ctx_put - drop the reference of @b to the libusb context of its
+ *                group; ftdi_deinit() frees it with the last board only
+ **/
+static void ftdi_ctx_put (board_t* b)
+{
+    if (!b->ev_shared) return;
+
+    b->group->ctx_refs --;
+    if (b->group->ctx_refs > 0) {
+        b->io.usb.ftdic.usb_ctx = NULL;
+    } else {
+        b->group->ctx = NULL;
+    }
+    b->ev_shared = 0;
+}
+
+/**
+ * ftdi_open_fail - undo ftdi_init() and the group context of a failed
+ *                  ftdi_xport_open()
+ **/
+static int ftdi_open_fail (board_t* b)
+{
+    ftdi_ctx_put (b);
+    ftdi_deinit (&(b->io.usb.ftdic));
+    return EXIT_FAILURE;
+}
+
+static int ftdi_xport_open (board_t* board)
+{
+    int ret;
+    int i;
+    struct ftdi_context *ftdic;
+
+    board->io.usb.tx_tc_cnt = 0;   // init transfer_control for async-write
+    board->io.usb.rx_buf = NULL;
+    board->io.usb.rx_head = 0;
+    board->io.usb.rx_offset = 0;
+    for (i = 0; i < RX_XFER_DEPTH; i++) {
+        board->io.usb.rx_xfer[i] = NULL;
+        board->io.usb.rx_state[i] = RX_IDLE;
+    }
+    ftdic = &(board->io.usb.ftdic);
+    if (ftdi_init(ftdic) < 0)
+    {
+        ERRP("ftdi_init failed\n");
+        return EXIT_FAILURE;
+    }
+
+    if (board->group) {
+        // one libusb context for the boards of a group, polled once a tick
+        if (board->group->ctx) {
+            libusb_exit (ftdic->usb_ctx);
+            ftdic->usb_ctx = board->group->ctx;
+        } else {
+            board->group->ctx = ftdic->usb_ctx;
+        }
+        board->group->ctx_refs ++;
+        board->ev_shared = 1;
+    }
+
+    ftdic->usb_read_timeout = 1000;
+    ftdic->usb_write_timeout = 1000;
+    ftdic->writebuffer_chunksize = board->cfg.tx_chunk_size;
+    if ((ret = ftdi_read_data_set_chunksize(ftdic, board->cfg.rx_chunk_size)) < 0) {
+        ERRP("ftdi_read_data_set_chunksize(): %d (%s)\n",
+              ret, ftdi_get_error_string(ftdic));
+        return ftdi_open_fail (board);
+    }
+
+    // the usb_devnum-th FT245 on the bus, for several boards per host
+    if ((ret = ftdi_usb_open_desc_index(ftdic, 0x0403, 0x6001, NULL, NULL,
+                                        board->io.usb.usb_devnum)) < 0)
+    {
+        ERRP("unable to open ftdi device: %d (%s)\n", ret, ftdi_get_error_string(ftdic));
+        return ftdi_open_fail (board);
+    }
+
+    if ((ret = ftdi_set_latency_timer(ftdic, 1)) < 0)
+    {
+        ERRP("ftdi_set_latency_timer(): %d (%s)\n", ret, ftdi_get_error_string(ftdic));
+        return ftdi_open_fail (board);
+    }
+
+    if ((ret = ftdi_usb_reset (ftdic)) < 0)
+    {
+        ERRP ("ftdi_usb_reset() failed: %d", ret);
+        return ftdi_open_fail (board);
+    }
+
+    if ((ret = ftdi_usb_purge_buffers (ftdic)) < 0)
+    {
+        ERRP ("ftdi_usb_purge_buffers() failed: %d", ret);
+        return ftdi_open_fail (board);
+    }
+
+    // Read out FTDIChip-ID of R type chips
+    if (ftdic->type == TYPE_R)
+    {
+        unsigned int chipid;
+        ERRP ("ftdi_read_chipid: %d\n", ftdi_read_chipid(ftdic, &chipid));
+        ERRP ("FTDI chipid: %X\n", chipid);
+    }
+
+    DP ("ftdic->max_packet_size(%u)\n", ftdic->max_packet_size);
+
+    // keep the bulk-in pipe busy
+    for (i = 0; i < RX_XFER_DEPTH; i++) {
+        struct libusb_transfer *xfer;
+        uint8_t *buf;
+
+        xfer = libusb_alloc_transfer (0);
+        buf = malloc (board->cfg.rx_chunk_size);
+        if ((xfer == NULL) || (buf == NULL)) {
+            ERRP ("libusb_alloc_transfer() failed\n");
+            libusb_free_transfer (xfer);
+            free (buf);
+            // cancel the transfers in flight, and close the device
+            ftdi_xport_close (board);
+            return EXIT_FAILURE;
+        }
+        libusb_fill_bulk_transfer (xfer, ftdic->usb_dev, ftdic->out_ep,
+                                   buf, board->cfg.rx_chunk_size, ftdi_xport_rx_cb,
+                                   &(board->io.usb.rx_state[i]),
+                                   ftdic->usb_read_timeout);
+        board->io.usb.rx_xfer[i] = xfer;
+        ftdi_rx_submit (board, i);
+    }
+    return 0;
+}
+
+static int ftdi_xport_connected (board_t* b)
+{
+    return (b->io.usb.ftdic.usb_connected);
+}
+
+static int ftdi_xport_submit_tx (board_t* b, const uint8_t *buf, int size)
+{
+    struct ftdi_transfer_control *tc;
+
+    assert (b->io.usb.tx_tc_cnt < TX_XFER_DEPTH);
+    tc = ftdi_write_data_submit (&(b->io.usb.ftdic), (uint8_t *) buf, size);
+    if (tc == NULL)
+    {
+        ERRP("ftdi_write_data_submit()\n");
+        return -1;
+    }
+    b->io.usb.tx_tc[b->io.usb.tx_tc_cnt] = tc;
+    b->io.usb.tx_tc_cnt ++;
+    return 0;
+}
+
+static int ftdi_xport_submit_rx (board_t* b, uint8_t *buf, int size)
+{
+    // the bulk-in transfers are in flight already; just take the request
+    assert (b->io.usb.rx_buf == NULL);
+    b->io.usb.rx_buf = buf;
+    b->io.usb.rx_req = size;
+    return 0;
+}
+
+static int ftdi_xport_poll (board_t* b, int dir)
+{
+    struct ftdi_context             *ftdic;
+    struct ftdi_transfer_control    *tc;
+    struct timeval                  poll_timeout = {0,0};
+    int                             ret;
+
+    ftdic = &(b->io.usb.ftdic);
+
+    if (dir == XFER_ANY) {
+        assert (ftdic->usb_dev != NULL);
+        while ((ret = libusb_handle_events_timeout_completed(ftdic->usb_ctx, &poll_timeout, NULL)) != 0) {
+            ERRP("libusb_handle_events_timeout_completed(%d)\n", ret);
+        }
+        return 0;
+    }
+
+    if (dir == XFER_RX) {
+        if (b->io.usb.rx_buf == NULL) {
+            return XFER_IDLE;
+        }
+        if ((b->io.usb.rx_state[b->io.usb.rx_head] == RX_PENDING) && !b->ev_polled) {
+            assert (ftdic->usb_dev != NULL);
+            if (libusb_handle_events_timeout_completed(ftdic->usb_ctx, &poll_timeout,
+                                                       &(b->io.usb.rx_state[b->io.usb.rx_head])) < 0)
+            {
+                ERRP("libusb_handle_events_timeout_completed() (%s)\n", ftdi_get_error_string(ftdic));
+                return XFER_BUSY;
+            }
+        }
+        ret = ftdi_rx_copy (b, b->io.usb.rx_buf, b->io.usb.rx_req);
+        if (ret == 0) {
+            DP ("rx_state(%d)\n", b->io.usb.rx_state[b->io.usb.rx_head]);
+            return XFER_BUSY;
+        }
+        b->io.usb.rx_buf = NULL;
+        return ret;
+    }
+
+    // XFER_TX: the oldest async write
+    if (b->io.usb.tx_tc_cnt == 0) {
+        return XFER_IDLE;
+    }
+    tc = b->io.usb.tx_tc[0];
+    if (tc->transfer && !b->ev_polled) {
+        // there's previous pending async transfer
+        assert (ftdic->usb_dev != NULL);
+        if (libusb_handle_events_timeout_completed(ftdic->usb_ctx, &poll_timeout, &(tc->completed)) < 0)
+        {
+            ERRP("libusb_handle_events_timeout_completed() (%s)\n", ftdi_get_error_string(ftdic));
+            return XFER_BUSY;
+        }
+    }
+
+    if (!tc->completed) {
+        DP ("tc->completed(%d)\n", tc->completed);
+        return XFER_BUSY;
+    }
+
+    ret = ftdi_transfer_data_done (tc);
+    b->io.usb.tx_tc_cnt --;
+    memmove (b->io.usb.tx_tc, b->io.usb.tx_tc + 1,
+             b->io.usb.tx_tc_cnt * sizeof(struct ftdi_transfer_control *));
+    if (ret <= 0) {
+        ERRP("dwBytesWritten(%d): (%s)\n", ret, ftdi_get_error_string(ftdic));
+        ret = 0;    // to issue another ftdi_write_data_submit()
+    }
+    return ret;
+}
+
+static int ftdi_xport_rx_pending (board_t* b)
+{
+    return (ftdi_rx_ready (b));
+}
+
+static int ftdi_xport_wait (board_t* b, int usec)
+{
+    struct ftdi_context *ftdic;
+    struct timeval      tv;
+    int                 ret;
+
+    ftdic = &(b->io.usb.ftdic);
+    tv.tv_sec = 0;
+    tv.tv_usec = usec;
+    if ((ret = libusb_handle_events_timeout (ftdic->usb_ctx, &tv)) < 0) {
+        ERRP("libusb_handle_events_timeout(%d)\n", ret);
+        return -1;
+    }
+    return 0;
+}
+
+static int ftdi_xport_write (board_t* b, const uint8_t *buf, int size)
+{
+    int ret;
+    struct ftdi_context *ftdic;
+
+    ftdic = &(b->io.usb.ftdic);
+    if ((ret = ftdi_write_data (ftdic, buf, size)) < 0)
+    {
+        ERRP("ftdi_write_data: %d (%s)\n", ret, ftdi_get_error_string(ftdic));
+    }
+    return ret;
+}
+
+static int ftdi_xport_reset (board_t* b, int purge)
+{
+    int     ret;
+    struct ftdi_context *ftdic;
+    struct timeval tv = {0, 2000};  // 2ms, for the latency timer to expire
+
+    ftdic = &(b->io.usb.ftdic);
+
+    if (!purge) {
+        // drop data already fetched from the device
+        ftdi_xport_poll (b, XFER_ANY);
+        ftdi_rx_drop (b);
+        return 0;
+    }
+
+    // to clear tx and rx queue
+    if ((ret = ftdi_usb_purge_buffers (ftdic)) < 0)
+    {
+        ERRP ("ftdi_usb_purge_buffers() failed: %d", ret);
+        return ret;
+    }
+
+    // to flush rx queue
+    libusb_handle_events_timeout (ftdic->usb_ctx, &tv);
+    ftdi_rx_drop (b);
+    return 0;
+}
+
+static int ftdi_xport_close (board_t* b)
+{
+    int ret;
+    int i, n;
+    struct ftdi_context *ftdic;
+    struct timeval tv = {0, 10000};
+
+    ftdic = &(b->io.usb.ftdic);
+
+    // cancel the bulk-in transfers, and wait for their callbacks
+    for (i = 0; i < RX_XFER_DEPTH; i++) {
+        if (b->io.usb.rx_state[i] == RX_PENDING) {
+            libusb_cancel_transfer (b->io.usb.rx_xfer[i]);
+        }
+    }
+    for (n = 0; n < 100; n++) {
+        for (i = 0; i < RX_XFER_DEPTH; i++) {
+            if (b->io.usb.rx_state[i] == RX_PENDING) break;
+        }
+        if (i == RX_XFER_DEPTH) break;
+        libusb_handle_events_timeout (ftdic->usb_ctx, &tv);
+    }
+    for (i = 0; i < RX_XFER_DEPTH; i++) {
+        if (b->io.usb.rx_xfer[i] == NULL) continue;
+        if (b->io.usb.rx_state[i] == RX_PENDING) {
+            ERRP ("rx_xfer[%d] is not cancelled\n", i);
+            continue;   // leak it rather than free a busy transfer
+        }
+        free (b->io.usb.rx_xfer[i]->buffer);
+        libusb_free_transfer (b->io.usb.rx_xfer[i]);
+        b->io.usb.rx_xfer[i] = NULL;
+    }
+
+    if ((ret = ftdi_usb_close(ftdic)) < 0)
+    {
+        ERRP("unable to close ftdi device: %d (%s)\n", ret, ftdi_get_error_string(ftdic));
+        // the group must not keep a reference for a board that is gone
+        ftdi_ctx_put (b);
+        return EXIT_FAILURE;
+    }
+    // ftdi_deinit() frees the context; only the last board of the group may
+    ftdi_ctx_put (b);
+    ftdi_deinit(ftdic);
+    return 0;
+}
+
+const wou_transport_t ftdi_transport = {
+    .name       = "ftdi",
+    .open       = ftdi_xport_open,
+    .connected  = ftdi_xport_connected,
+    .submit_tx  = ftdi_xport_submit_tx,
+    .submit_rx  = ftdi_xport_submit_rx,
+    .poll       = ftdi_xport_poll,
+    .rx_pending = ftdi_xport_rx_pending,
+    .wait       = ftdi_xport_wait,
+    .write      = ftdi_xport_write,
+    .reset      = ftdi_xport_reset,
+    .close      = ftdi_xport_close
+};
+
+// vim:sw=4:sts=4:et:
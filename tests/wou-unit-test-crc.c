@@ -0,0 +1,94 @@
+/**
+ * wou-unit-test-crc - check crcFast() against the bitwise crcSlow()
+ *
+ * No board is required.  Covers the CRC-16 check value, every length up
+ * to a few WOU frames, and every alignment of the message, for the
+ * kernel of this CPU, the portable crcSliced(), crcFastCopy(), and the
+ * CRC of a frame built up piecewise.
+ **/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "wou/crc.h"
+
+#define TEST_MAX_SIZE   (3 * 261)   // a few max-sized WOU frames
+#define TEST_SEED       1
+
+int main(void)
+{
+    static const unsigned char check[] = "123456789";
+    unsigned char   buf[TEST_MAX_SIZE + 8];
+    unsigned char   copy[TEST_MAX_SIZE + 16];
+    unsigned int    seed;
+    crc             fast, slow, sliced;
+    int             ret;
+    int             offset;
+    int             size;
+    int             i;
+
+    crcInit();
+    crcInit();      // idempotent
+    printf ("kernel: %s\n", crcKernel ());
+
+    ret = 0;
+    fast = crcFast (check, 9);
+    if (fast != CHECK_VALUE) {
+        printf ("FAIL: %s check value (0x%04X), expected (0x%04X)\n",
+                CRC_NAME, fast, CHECK_VALUE);
+        ret = -1;
+    }
+
+    seed = TEST_SEED;
+    for (i = 0; i < sizeof(buf); i++) {
+        buf[i] = rand_r (&seed);
+    }
+
+    for (offset = 0; offset < 8; offset++) {
+        for (size = 0; size <= TEST_MAX_SIZE; size++) {
+            fast = crcFast (buf + offset, size);
+            slow = crcSlow (buf + offset, size);
+            sliced = crcSliced (buf + offset, size);
+            if ((fast != slow) || (sliced != slow)) {
+                printf ("FAIL: offset(%d) size(%d) crcFast(0x%04X) crcSliced(0x%04X) crcSlow(0x%04X)\n",
+                        offset, size, fast, sliced, slow);
+                ret = -1;
+            }
+        }
+    }
+
+    // a frame split in two: header patched in after the payload
+    for (size = 0; size <= TEST_MAX_SIZE; size += 7) {
+        for (i = 0; i <= size; i += 5) {
+            slow = crcSlow (buf, size);
+            fast = crcFastUpdate (crcFast (buf, i), buf + i, size - i);
+            sliced = crcCombine (crcFast (buf, i), crcFast (buf + i, size - i), size - i);
+            if ((fast != slow) || (sliced != slow)) {
+                printf ("FAIL: split(%d) size(%d) crcFastUpdate(0x%04X) crcCombine(0x%04X) crcSlow(0x%04X)\n",
+                        i, size, fast, sliced, slow);
+                ret = -1;
+            }
+        }
+    }
+
+    // copy-and-checksum, to every alignment of the destination
+    for (offset = 0; offset < 8; offset++) {
+        for (size = 0; size <= TEST_MAX_SIZE; size++) {
+            memset (copy, 0xA5, sizeof(copy));
+            slow = crcSlow (buf, size);
+            fast = crcFastCopy (crcFast (buf, 0), copy + offset, buf, size);
+            if ((fast != slow) || memcmp (copy + offset, buf, size)
+                || (copy[offset + size] != 0xA5) || (offset && (copy[offset - 1] != 0xA5))) {
+                printf ("FAIL: offset(%d) size(%d) crcFastCopy(0x%04X) crcSlow(0x%04X)\n",
+                        offset, size, fast, slow);
+                ret = -1;
+            }
+        }
+    }
+
+    printf ("%s\n", ret ? "FAIL" : "PASS");
+    return (ret ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+// vim:sw=4:sts=4:et:
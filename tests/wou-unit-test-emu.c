@@ -0,0 +1,841 @@
+/**
+ * wou-unit-test-emu - run the GBN engine against the in-process emulator
+ *
+ * No board is required.  Writes a pattern to the emulated wishbone space,
+ * command by command or in a batch, reads it back through WOU frames,
+ * and repeats with link errors and noise injected, under SELECTIVE-REPEAT
+ * and then GO-BACK-N, with a small window and small USB transfers, over
+ * a slow USB, on two boards at once, on a group of four boards with one
+ * event loop, with commands of four producer threads, and with writes
+ * merged into a FIFO port.
+ **/
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "wou.h"
+#include "wb_regs.h"
+#include "mailtag.h"
+#include "wou/transport.h"
+
+#define TEST_ADDR   0x2000  // free space of the emulated wishbone bus
+#define TEST_SIZE   1024
+#define TEST_WAIT   5       // max seconds to wait for a read back
+
+static uint32_t mail_count;
+static uint32_t crc_count;
+
+static void fetchmail(const uint8_t *buf_head)
+{
+    uint16_t    mail_tag;
+
+    memcpy(&mail_tag, (buf_head + 2), sizeof(uint16_t));
+    assert (mail_tag == MT_DEBUG);
+    mail_count ++;
+}
+
+static void crc_error(int32_t crc_err_count)
+{
+    crc_count = crc_err_count;
+}
+
+// wait for the registers at TEST_ADDR to read back as @buf
+static int read_back (wou_param_t *w_param, const uint8_t *buf)
+{
+    uint8_t     dummy[64];
+    const uint8_t *reg;
+    struct timespec t0, t1;
+    int         i;
+
+    reg = wou_reg_ptr (w_param, TEST_ADDR);
+    clock_gettime (CLOCK_MONOTONIC, &t0);
+    while (memcmp (reg, buf, TEST_SIZE) != 0) {
+        clock_gettime (CLOCK_MONOTONIC, &t1);
+        if ((t1.tv_sec - t0.tv_sec) > TEST_WAIT) break;
+        // the read data is gone with a corrupted ACK; ask again
+        for (i = 0; i < TEST_SIZE; i += 64) {
+            if (memcmp (reg + i, buf + i, 64) != 0) {
+                wou_cmd (w_param, WB_RD_CMD, TEST_ADDR + i, 64, dummy);
+            }
+        }
+        wou_flush (w_param);
+    }
+    return (memcmp (reg, buf, TEST_SIZE) != 0) ? -1 : 0;
+}
+
+static int run_pattern (wou_param_t *w_param, uint8_t seed)
+{
+    uint8_t     buf[TEST_SIZE];
+    int         i;
+
+    for (i = 0; i < TEST_SIZE; i++) {
+        buf[i] = (uint8_t) (seed + i * 7);
+    }
+
+    // write with packets of all sizes
+    i = 0;
+    while (i < TEST_SIZE) {
+        int dsize = 1 + (i % MAX_DSIZE);
+        if ((i + dsize) > TEST_SIZE) dsize = TEST_SIZE - i;
+        wou_cmd (w_param, WB_WR_CMD, TEST_ADDR + i, dsize, buf + i);
+        i += dsize;
+    }
+    wou_flush (w_param);
+
+    // read back
+    for (i = 0; i < TEST_SIZE; i += 64) {
+        wou_cmd (w_param, WB_RD_CMD, TEST_ADDR + i, 64, buf);
+        wou_flush (w_param);
+    }
+
+    for (i = 0; i < TEST_SIZE; i++) {
+        buf[i] = (uint8_t) (seed + i * 7);
+    }
+    if (read_back (w_param, buf) != 0) {
+        printf ("FAIL: read back seed(%d)\n", seed);
+        return -1;
+    }
+    if (memcmp (emu_wb_ptr (w_param->board) + TEST_ADDR, buf, TEST_SIZE) != 0) {
+        printf ("FAIL: emulated registers seed(%d)\n", seed);
+        return -1;
+    }
+    return 0;
+}
+
+// GO-BACK-N starts TX TIMEOUT checking after loading the RISC program;
+// without it, a lost wouf at the tail of the window is never re-sent
+static int load_risc (wou_param_t *w_param)
+{
+    char        binfile[] = "/tmp/wou-unit-test-emu.XXXXXX";
+    uint8_t     image[8];
+    int         fd;
+    int         n;
+
+    memset (image, 0, sizeof(image));
+    fd = mkstemp (binfile);
+    if ((fd < 0) || (write (fd, image, sizeof(image)) != sizeof(image))) {
+        printf ("FAIL: %s\n", binfile);
+        return -1;
+    }
+    close (fd);
+    n = wou_prog_risc (w_param, binfile);
+    unlink (binfile);
+    if (n != 0) {
+        printf ("FAIL: wou_prog_risc()\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int run_backpressure (wou_param_t *w_param)
+{
+    wou_window_t win;
+    struct timespec t0, t1;
+    int         n;
+
+    if (load_risc (w_param) != 0) {
+        return -1;
+    }
+
+    // a dead link fills the window, and wou_flush() must not block
+    emu_set_faults (w_param->board, 1000000, 0);
+    n = 0;
+    while (wou_flush (w_param) == 0) {
+        if (++n > 1000) {
+            printf ("FAIL: wou_flush() never returns -1\n");
+            return -1;
+        }
+    }
+    if (errno != EAGAIN) {
+        printf ("FAIL: errno(%d) of wou_flush()\n", errno);
+        return -1;
+    }
+    wou_window (w_param, &win);
+    printf ("frames(%d) free(%d) pending(%d) unacked(%d) queued(%d)\n",
+            n, win.free_frames, win.pending_frames, win.unacked_frames,
+            win.queued_bytes);
+    if ((win.free_frames != 0) || (win.unacked_frames == 0)) {
+        printf ("FAIL: window of a dead link\n");
+        return -1;
+    }
+
+    // GO-BACK-N drains the window once the link is back
+    emu_set_faults (w_param->board, 0, 0);
+    clock_gettime (CLOCK_MONOTONIC, &t0);
+    while (wou_flush (w_param) != 0) {
+        clock_gettime (CLOCK_MONOTONIC, &t1);
+        if ((t1.tv_sec - t0.tv_sec) > TEST_WAIT) {
+            printf ("FAIL: window is not drained\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int run_noise (wou_param_t *w_param)
+{
+    static const uint8_t sync[] = {WOUF_PREAMBLE, WOUF_PREAMBLE, WOUF_SOFD, MAX_PSIZE, TYP_WOUF};
+    uint8_t     noise[4096];
+    uint32_t    crc_before;
+    unsigned int seed;
+    int         i;
+
+    // an EMI burst: SYNC words of max-sized frames, then random bytes
+    seed = 1;
+    for (i = 0; i < sizeof(noise); i++) {
+        noise[i] = (i < (sizeof(noise) / 2)) ? sync[i % sizeof(sync)] : rand_r (&seed);
+    }
+    crc_before = crc_count;
+    if (emu_inject (w_param->board, noise, sizeof(noise)) != sizeof(noise)) {
+        printf ("FAIL: emu_inject()\n");
+        return -1;
+    }
+    if (run_pattern (w_param, 0x44) != 0) {
+        return -1;
+    }
+    printf ("crc_errors(%u)\n", crc_count - crc_before);
+    if (crc_count == crc_before) {
+        printf ("FAIL: no CRC error from the noise\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int run_gbn (void)
+{
+    wou_param_t w_param;
+    uint64_t    tx_dsize, rx_dsize;
+    int         ret;
+    int         i;
+
+    // an FPGA which is not asked for SELECTIVE-REPEAT, by default
+    wou_init(&w_param, "7i43u-emu", 0, NULL);
+    if (wou_connect(&w_param) == -1) {
+        printf ("FAIL: wou_connect()\n");
+        return -1;
+    }
+    ret = run_pattern (&w_param, 0x99);
+    emu_set_faults (w_param.board, 50000, 50000);   // 5%
+    for (i = 0; i < 8; i++) {
+        ret |= run_pattern (&w_param, 0xA0 + i);
+    }
+    if (wou_arq (&w_param) != WOU_ARQ_GBN) {
+        printf ("FAIL: ARQ mode(%d) without ARQ_SR\n", wou_arq (&w_param));
+        ret = -1;
+    }
+    wou_dsize (&w_param, &tx_dsize, &rx_dsize);
+    printf ("tx_dsize(%llu) rx_dsize(%llu)\n",
+            (unsigned long long) tx_dsize, (unsigned long long) rx_dsize);
+    wou_close(&w_param);
+    return ret;
+}
+
+static int run_config (void)
+{
+    wou_param_t w_param;
+    wou_config_t cfg;
+    wou_window_t win;
+    int         ret;
+    int         i;
+
+    wou_config_default (&cfg);
+    cfg.window = 65;
+    if (wou_init_config (&w_param, "7i43u-emu", 0, NULL, &cfg) != -1) {
+        printf ("FAIL: window(%d) is accepted\n", cfg.window);
+        return -1;
+    }
+
+    // a short window over small USB transfers
+    wou_config_default (&cfg);
+    cfg.window = 4;
+    cfg.frames = 16;
+    cfg.tx_chunk_size = 64;
+    cfg.tx_burst_min = 16;
+    cfg.tx_burst_max = 64;
+    cfg.rx_chunk_size = 64;
+    cfg.rx_burst_min = 8;
+    if (wou_init_config (&w_param, "7i43u-emu", 0, NULL, &cfg) != 0) {
+        printf ("FAIL: wou_init_config()\n");
+        return -1;
+    }
+    wou_set_arq (&w_param, WOU_ARQ_SR);
+    if (wou_connect (&w_param) == -1) {
+        printf ("FAIL: wou_connect()\n");
+        return -1;
+    }
+    ret = load_risc (&w_param);
+    ret |= run_pattern (&w_param, 0xB0);
+    emu_set_faults (w_param.board, 50000, 50000);   // 5%
+    for (i = 0; i < 8; i++) {
+        ret |= run_pattern (&w_param, 0xB1 + i);
+    }
+    wou_window (&w_param, &win);
+    printf ("free(%d) pending(%d) unacked(%d)\n",
+            win.free_frames, win.pending_frames, win.unacked_frames);
+    if ((win.free_frames + win.pending_frames + win.unacked_frames) > (cfg.frames - 5)) {
+        printf ("FAIL: window of frames(%d)\n", cfg.frames);
+        ret = -1;
+    }
+    wou_close(&w_param);
+    return ret;
+}
+
+static int run_burst (void)
+{
+    wou_param_t w_param;
+    wou_config_t cfg;
+    wou_window_t win;
+    struct timespec t0, t1;
+    int         ret;
+    int         i;
+
+    wou_config_default (&cfg);
+    cfg.tx_burst_min = 32;
+    cfg.rx_burst_min = 8;
+    if (wou_init_config (&w_param, "7i43u-emu", 0, NULL, &cfg) != 0) {
+        printf ("FAIL: wou_init_config()\n");
+        return -1;
+    }
+    wou_set_arq (&w_param, WOU_ARQ_SR);
+    if (wou_connect (&w_param) == -1) {
+        printf ("FAIL: wou_connect()\n");
+        return -1;
+    }
+
+    // a slow USB: writes of 32 bytes fall behind the traffic
+    emu_set_write_time (w_param.board, 100000);
+    ret = 0;
+    for (i = 0; i < 8; i++) {
+        ret |= run_pattern (&w_param, 0xC0 + i);
+    }
+    wou_window (&w_param, &win);
+    printf ("loaded: tx_burst(%d) rx_burst(%d)\n", win.tx_burst, win.rx_burst);
+    if ((win.tx_burst <= cfg.tx_burst_min) || (win.tx_burst > cfg.tx_burst_max)) {
+        printf ("FAIL: tx_burst(%d) of a backlog\n", win.tx_burst);
+        ret = -1;
+    }
+
+    // an idle link takes the bursts back down, for latency
+    emu_set_write_time (w_param.board, 0);
+    clock_gettime (CLOCK_MONOTONIC, &t0);
+    do {
+        wou_update (&w_param);
+        wou_window (&w_param, &win);
+        clock_gettime (CLOCK_MONOTONIC, &t1);
+    } while ((win.tx_burst > cfg.tx_burst_min) && ((t1.tv_sec - t0.tv_sec) <= TEST_WAIT));
+    printf ("idle: tx_burst(%d) rx_burst(%d)\n", win.tx_burst, win.rx_burst);
+    if (win.tx_burst != cfg.tx_burst_min) {
+        printf ("FAIL: tx_burst(%d) of an idle link\n", win.tx_burst);
+        ret = -1;
+    }
+    if ((win.rx_burst < cfg.rx_burst_min) || (win.rx_burst > cfg.rx_chunk_size)) {
+        printf ("FAIL: rx_burst(%d)\n", win.rx_burst);
+        ret = -1;
+    }
+    wou_close(&w_param);
+    return ret;
+}
+
+static int run_boards (void)
+{
+    wou_param_t w_param[2];
+    int         ret;
+    int         i;
+
+    // two boards of one process, each with its own TX TIMEOUT
+    ret = 0;
+    for (i = 0; i < 2; i++) {
+        wou_init (&w_param[i], "7i43u-emu", i, NULL);
+        wou_set_arq (&w_param[i], WOU_ARQ_SR);
+        if (wou_connect (&w_param[i]) == -1) {
+            printf ("FAIL: wou_connect() of board(%d)\n", i);
+            return -1;
+        }
+        ret |= load_risc (&w_param[i]);
+    }
+    emu_set_faults (w_param[1].board, 50000, 50000);   // 5% on one of them
+    for (i = 0; i < 16; i++) {
+        ret |= run_pattern (&w_param[i & 1], 0xD0 + i);
+    }
+    for (i = 0; i < 2; i++) {
+        wou_close (&w_param[i]);
+    }
+    return ret;
+}
+
+static int run_batch (wou_param_t *w_param, uint8_t seed)
+{
+    uint8_t     buf[TEST_SIZE];
+    wou_op_t    ops[TEST_SIZE];
+    int         n;
+    int         i;
+
+    for (i = 0; i < TEST_SIZE; i++) {
+        buf[i] = (uint8_t) (seed + i * 7);
+    }
+
+    // packets of all sizes, in one batch over several woufs
+    n = 0;
+    i = 0;
+    while (i < TEST_SIZE) {
+        int dsize = 1 + (n % MAX_DSIZE);
+        if ((i + dsize) > TEST_SIZE) dsize = TEST_SIZE - i;
+        ops[n].func = WB_WR_CMD;
+        ops[n].wb_addr = TEST_ADDR + i;
+        ops[n].dsize = dsize;
+        ops[n].data = buf + i;
+        n ++;
+        i += dsize;
+    }
+    ops[n].func = WB_WR_CMD;
+    ops[n].wb_addr = TEST_ADDR;
+    ops[n].dsize = MAX_DSIZE + 1;
+    ops[n].data = buf;
+    if ((wou_cmd_batch (w_param, ops, n + 1) != -1) || (errno != EINVAL)) {
+        printf ("FAIL: wou_cmd_batch() of an invalid command\n");
+        return -1;
+    }
+    if (wou_cmd_batch (w_param, ops, n) != 0) {
+        printf ("FAIL: wou_cmd_batch()\n");
+        return -1;
+    }
+    wou_flush (w_param);
+
+    if (read_back (w_param, buf) != 0) {
+        printf ("FAIL: read back of a batch seed(%d)\n", seed);
+        return -1;
+    }
+    return 0;
+}
+
+static int run_fifo (void)
+{
+    wou_param_t w_param;
+    uint8_t     buf[TEST_SIZE];
+    uint16_t    val;
+    int         ret;
+    int         i;
+
+    wou_init (&w_param, "7i43u-emu", 0, NULL);
+    if ((wou_connect (&w_param) == -1)
+        || (wou_fifo_port (&w_param, TEST_ADDR, 32) != 0)) {
+        printf ("FAIL: wou_fifo_port()\n");
+        return -1;
+    }
+    ret = load_risc (&w_param);
+
+    // 16 writes of 2 bytes to the FIFO port go in one packet; the
+    // emulator has no FIFO, and stores the 32 bytes from the port on
+    memset (buf, 0, sizeof(buf));
+    for (i = 0; i < 16; i++) {
+        val = 0x5A00 + i;
+        memcpy (buf + i * sizeof(uint16_t), &val, sizeof(uint16_t));
+        wou_cmd (&w_param, WB_WR_CMD, TEST_ADDR, sizeof(uint16_t), (uint8_t *) &val);
+    }
+    // writes to the same register, not a FIFO port, stay apart
+    val = 0x1234;
+    wou_cmd (&w_param, WB_WR_CMD, TEST_ADDR + 64, sizeof(uint16_t), (uint8_t *) &val);
+    val = 0x5678;
+    wou_cmd (&w_param, WB_WR_CMD, TEST_ADDR + 64, sizeof(uint16_t), (uint8_t *) &val);
+    memcpy (buf + 64, &val, sizeof(uint16_t));
+    wou_flush (&w_param);
+
+    if (read_back (&w_param, buf) != 0) {
+        printf ("FAIL: writes to a FIFO port are not merged\n");
+        ret = -1;
+    }
+    wou_close (&w_param);
+    return ret;
+}
+
+#define TEST_PRODUCERS  4
+#define TEST_ROUNDS     64
+
+typedef struct {
+    wou_producer_t  prod;
+    int             id;
+    int             fail;
+} producer_t;
+
+static int producers_done;
+
+// each producer writes its quarter of TEST_ADDR, round by round
+static void *producer (void *arg)
+{
+    producer_t  *p = (producer_t *) arg;
+    uint8_t     buf[64];
+    int         part = TEST_SIZE / TEST_PRODUCERS;
+    int         r, i, j;
+
+    for (r = 0; r < TEST_ROUNDS; r++) {
+        for (i = 0; i < part; i += 64) {
+            for (j = 0; j < 64; j++) {
+                buf[j] = (uint8_t) (r + p->id * 0x10 + (i + j) * 3);
+            }
+            while (wou_producer_cmd (&p->prod, WB_WR_CMD,
+                                     TEST_ADDR + p->id * part + i, 64, buf) != 0) {
+                if (errno != EAGAIN) {
+                    p->fail = 1;
+                    break;
+                }
+                sched_yield ();     // wait for the framer
+            }
+        }
+    }
+    __atomic_add_fetch (&producers_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static int run_producers (void)
+{
+    wou_param_t w_param;
+    producer_t  p[TEST_PRODUCERS];
+    pthread_t   tid[TEST_PRODUCERS];
+    uint8_t     buf[TEST_SIZE];
+    uint8_t     val;
+    struct timespec tick = {0, 200000};
+    int         part = TEST_SIZE / TEST_PRODUCERS;
+    int         ret;
+    int         i;
+
+    wou_init (&w_param, "7i43u-emu", 0, NULL);
+    if (wou_connect (&w_param) == -1) {
+        printf ("FAIL: wou_connect()\n");
+        return -1;
+    }
+    ret = load_risc (&w_param);
+    for (i = 0; i < TEST_PRODUCERS; i++) {
+        p[i].id = i;
+        p[i].fail = 0;
+        if (wou_producer_open (&w_param, &p[i].prod) != 0) {
+            printf ("FAIL: wou_producer_open()\n");
+            return -1;
+        }
+    }
+
+    // queues are merged in the order of wou_producer_open(),
+    // whatever the order of staging
+    val = 0x55;
+    wou_producer_cmd (&p[1].prod, WB_WR_CMD, TEST_ADDR, 1, &val);
+    val = 0xAA;
+    wou_producer_cmd (&p[0].prod, WB_WR_CMD, TEST_ADDR, 1, &val);
+    wou_flush (&w_param);
+    memset (buf, 0, sizeof(buf));
+    buf[0] = 0x55;
+    if (read_back (&w_param, buf) != 0) {
+        printf ("FAIL: merged out of the order of the producers\n");
+        ret = -1;
+    }
+
+    // the framer flushes a wouf every tick, as a servo thread does
+    producers_done = 0;
+    for (i = 0; i < TEST_PRODUCERS; i++) {
+        pthread_create (&tid[i], NULL, producer, &p[i]);
+    }
+    while (__atomic_load_n (&producers_done, __ATOMIC_ACQUIRE) < TEST_PRODUCERS) {
+        wou_flush (&w_param);
+        nanosleep (&tick, NULL);
+    }
+    for (i = 0; i < TEST_PRODUCERS; i++) {
+        pthread_join (tid[i], NULL);
+        ret |= -p[i].fail;
+        wou_producer_close (&p[i].prod);
+    }
+    wou_flush (&w_param);
+
+    for (i = 0; i < TEST_SIZE; i++) {
+        buf[i] = (uint8_t) (TEST_ROUNDS - 1 + (i / part) * 0x10 + (i % part) * 3);
+    }
+    if (read_back (&w_param, buf) != 0) {
+        printf ("FAIL: read back of %d producers\n", TEST_PRODUCERS);
+        ret = -1;
+    }
+    wou_close (&w_param);
+    return ret;
+}
+
+// more than one wouf staged against a full window: wou_flush() must
+// return EAGAIN at once, and send the rest once the link is back
+static int run_producer_backpressure (void)
+{
+    wou_param_t w_param;
+    wou_producer_t prod[2];
+    uint8_t     buf[TEST_SIZE];
+    struct timespec t0, t1;
+    int64_t     usec;
+    int         part = TEST_SIZE / 2;
+    int         ret;
+    int         i, j;
+
+    wou_init (&w_param, "7i43u-emu", 0, NULL);
+    if (wou_connect (&w_param) == -1) {
+        printf ("FAIL: wou_connect()\n");
+        return -1;
+    }
+    ret = load_risc (&w_param);
+    for (i = 0; i < 2; i++) {
+        if (wou_producer_open (&w_param, &prod[i]) != 0) {
+            printf ("FAIL: wou_producer_open()\n");
+            return -1;
+        }
+    }
+
+    // a dead link fills the window
+    emu_set_faults (w_param.board, 1000000, 0);
+    for (i = 0; wou_flush (&w_param) == 0; i++) {
+        if (i > 1000) {
+            printf ("FAIL: wou_flush() never returns -1\n");
+            return -1;
+        }
+    }
+
+    // TEST_SIZE bytes take several woufs
+    for (i = 0; i < TEST_SIZE; i++) {
+        buf[i] = (uint8_t) (0xC3 + i * 7);
+    }
+    for (i = 0; i < 2; i++) {
+        for (j = 0; j < part; j += 64) {
+            if (wou_producer_cmd (&prod[i], WB_WR_CMD, TEST_ADDR + i * part + j,
+                                  64, buf + i * part + j) != 0) {
+                printf ("FAIL: wou_producer_cmd()\n");
+                ret = -1;
+            }
+        }
+    }
+    clock_gettime (CLOCK_MONOTONIC, &t0);
+    if ((wou_flush (&w_param) != -1) || (errno != EAGAIN)) {
+        printf ("FAIL: wou_flush() of a full window\n");
+        ret = -1;
+    }
+    clock_gettime (CLOCK_MONOTONIC, &t1);
+    usec = (t1.tv_sec - t0.tv_sec) * 1000000LL + (t1.tv_nsec - t0.tv_nsec) / 1000;
+    printf ("wou_flush() of a full window: %lldus\n", (long long) usec);
+    if (usec > 100000) {
+        printf ("FAIL: wou_flush() waits for the window\n");
+        ret = -1;
+    }
+
+    // the commands left staged go out once the link is back
+    emu_set_faults (w_param.board, 0, 0);
+    clock_gettime (CLOCK_MONOTONIC, &t0);
+    while (wou_flush (&w_param) != 0) {
+        clock_gettime (CLOCK_MONOTONIC, &t1);
+        if ((t1.tv_sec - t0.tv_sec) > TEST_WAIT) {
+            printf ("FAIL: staged commands are not sent\n");
+            ret = -1;
+            break;
+        }
+    }
+    if (read_back (&w_param, buf) != 0) {
+        printf ("FAIL: read back of the staged commands\n");
+        ret = -1;
+    }
+    for (i = 0; i < 2; i++) {
+        wou_producer_close (&prod[i]);
+    }
+    wou_close (&w_param);
+    return ret;
+}
+
+static int run_group (void)
+{
+    wou_group_t group;
+    wou_param_t w_param[4];
+    uint8_t     buf[TEST_SIZE];
+    const uint8_t *reg;
+    struct timespec t0, t1;
+    int         ret;
+    int         ok;
+    int         i, j;
+
+    // four boards flushed and polled together
+    ret = 0;
+    if (wou_group_init (&group) != 0) {
+        printf ("FAIL: wou_group_init()\n");
+        return -1;
+    }
+    for (i = 0; i < 4; i++) {
+        wou_init (&w_param[i], "7i43u-emu", i, NULL);
+        if ((wou_group_add (&group, &w_param[i]) != 0)
+            || (wou_connect (&w_param[i]) == -1)) {
+            printf ("FAIL: wou_group_add() of board(%d)\n", i);
+            return -1;
+        }
+        ret |= load_risc (&w_param[i]);
+    }
+    if (wou_group_add (&group, &w_param[0]) == 0) {
+        printf ("FAIL: a board in two groups\n");
+        ret = -1;
+    }
+    emu_set_faults (w_param[3].board, 50000, 50000);   // 5% on one of them
+
+    for (i = 0; i < 4; i++) {
+        for (j = 0; j < TEST_SIZE; j++) {
+            buf[j] = (uint8_t) (0xE0 + i + j * 7);
+        }
+        for (j = 0; j < TEST_SIZE; j += 64) {
+            wou_cmd (&w_param[i], WB_WR_CMD, TEST_ADDR + j, 64, buf + j);
+        }
+    }
+    wou_group_flush_all (&group);
+
+    // read back all boards with one poll per tick
+    clock_gettime (CLOCK_MONOTONIC, &t0);
+    do {
+        ok = 0;
+        for (i = 0; i < 4; i++) {
+            for (j = 0; j < TEST_SIZE; j++) {
+                buf[j] = (uint8_t) (0xE0 + i + j * 7);
+            }
+            reg = wou_reg_ptr (&w_param[i], TEST_ADDR);
+            if (memcmp (reg, buf, TEST_SIZE) == 0) {
+                ok ++;
+                continue;
+            }
+            for (j = 0; j < TEST_SIZE; j += 64) {
+                if (memcmp (reg + j, buf + j, 64) != 0) {
+                    wou_cmd (&w_param[i], WB_RD_CMD, TEST_ADDR + j, 64, buf + j);
+                }
+            }
+        }
+        wou_group_flush_all (&group);
+        for (j = 0; j < 10; j++) {
+            wou_group_poll (&group, 1000);
+        }
+        clock_gettime (CLOCK_MONOTONIC, &t1);
+    } while ((ok < 4) && ((t1.tv_sec - t0.tv_sec) <= TEST_WAIT));
+    if (ok < 4) {
+        printf ("FAIL: read back of %d boards in a group\n", 4 - ok);
+        ret = -1;
+    }
+
+    for (i = 0; i < 4; i++) {
+        wou_close (&w_param[i]);
+    }
+    wou_group_free (&group);
+    return ret;
+}
+
+int main(void)
+{
+    wou_param_t w_param;
+    wou_window_t win;
+    uint64_t    tx_dsize, rx_dsize;
+    struct timespec t0, t1;
+    int         ret;
+    int         i;
+
+    wou_init(&w_param, "7i43u-emu", 0, NULL);
+    wou_set_arq (&w_param, WOU_ARQ_SR);     // the emulator knows ARQ_SR
+    if (wou_connect(&w_param) == -1) {
+        fprintf(stderr, "Connection failed\n");
+        exit(EXIT_FAILURE);
+    }
+    wou_set_mbox_cb (&w_param, fetchmail);
+    wou_set_crc_error_cb (&w_param, crc_error);
+
+    ret = 0;
+    printf ("clean link:\n");
+    ret |= run_pattern (&w_param, 0x11);
+    ret |= run_pattern (&w_param, 0x22);
+    ret |= run_batch (&w_param, 0x2B);
+    if (wou_arq (&w_param) != WOU_ARQ_SR) {
+        printf ("FAIL: ARQ_SR is not agreed\n");
+        ret = -1;
+    }
+
+    printf ("lossy link:\n");
+    emu_set_faults (w_param.board, 50000, 50000);   // 5%
+    // enough traffic to wrap the TX and RX rings a few times
+    for (i = 0; i < 32; i++) {
+        ret |= run_pattern (&w_param, 0x33 + i);
+    }
+    emu_set_faults (w_param.board, 0, 0);
+    ret |= run_pattern (&w_param, 0x55);
+
+    printf ("noise burst:\n");
+    ret |= run_noise (&w_param);
+
+    printf ("backpressure:\n");
+    ret |= run_backpressure (&w_param);
+    ret |= run_pattern (&w_param, 0x5A);
+
+    // MAILBOX comes every 0.65535ms
+    clock_gettime (CLOCK_MONOTONIC, &t0);
+    do {
+        wou_update (&w_param);
+        clock_gettime (CLOCK_MONOTONIC, &t1);
+    } while ((mail_count == 0) && ((t1.tv_sec - t0.tv_sec) <= TEST_WAIT));
+
+    wou_dsize (&w_param, &tx_dsize, &rx_dsize);
+    printf ("tx_dsize(%llu) rx_dsize(%llu) mails(%u) crc_errors(%u)\n",
+            (unsigned long long) tx_dsize, (unsigned long long) rx_dsize,
+            mail_count, crc_count);
+    if (mail_count == 0) {
+        printf ("FAIL: no MAILBOX\n");
+        ret = -1;
+    }
+
+    printf ("I/O thread:\n");
+    if (wou_io_thread_start (&w_param) != 0) {
+        printf ("FAIL: wou_io_thread_start()\n");
+        ret = -1;
+    }
+    ret |= run_pattern (&w_param, 0x66);
+    // the emulator belongs to the I/O thread; restart it around changes
+    wou_io_thread_stop (&w_param);
+    emu_set_faults (w_param.board, 50000, 50000);
+    wou_io_thread_start (&w_param);
+    for (i = 0; i < 8; i++) {
+        ret |= run_pattern (&w_param, 0x77 + i);
+    }
+    wou_io_thread_stop (&w_param);
+    emu_set_faults (w_param.board, 0, 0);
+    wou_io_thread_start (&w_param);
+    ret |= run_pattern (&w_param, 0x88);
+    wou_io_thread_stop (&w_param);
+
+    // the RTT of the emulator is way below RTO_MIN_NSEC
+    wou_window (&w_param, &win);
+    printf ("srtt(%dus) rto(%dus)\n", win.srtt_usec, win.rto_usec);
+    if ((win.srtt_usec <= 0) || (win.rto_usec > 10000)) {
+        printf ("FAIL: RTO is not adapted to the RTT\n");
+        ret = -1;
+    }
+
+    wou_close(&w_param);
+
+    printf ("GO-BACK-N:\n");
+    ret |= run_gbn ();
+
+    printf ("wou_config_t:\n");
+    ret |= run_config ();
+
+    printf ("adaptive bursts:\n");
+    ret |= run_burst ();
+
+    printf ("two boards:\n");
+    ret |= run_boards ();
+
+    printf ("board group:\n");
+    ret |= run_group ();
+
+    printf ("producer threads:\n");
+    ret |= run_producers ();
+    ret |= run_producer_backpressure ();
+
+    printf ("FIFO port:\n");
+    ret |= run_fifo ();
+
+    printf ("%s\n", ret ? "FAIL" : "PASS");
+    return (ret ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+// vim:sw=4:sts=4:et:
@@ -81,21 +81,24 @@ static uint32_t _dt = 0;
 static void write_mot_param (wou_param_t *w_param, uint32_t joint, uint32_t addr, int32_t data)
 {
     uint16_t    sync_cmd;
-    uint8_t     buf[MAX_DSIZE];
+    uint8_t     buf[5][sizeof(uint16_t)];
+    wou_op_t    ops[5];
     int         j;
 
-    for(j=0; j<sizeof(int32_t); j++) {
-        sync_cmd = SYNC_DATA | ((uint8_t *)&data)[j];
-        memcpy(buf, &sync_cmd, sizeof(uint16_t));
-        wou_cmd(w_param, WB_WR_CMD, (uint16_t) (JCMD_BASE | JCMD_SYNC_CMD),
-                sizeof(uint16_t), buf);
-        // wou_flush(&w_param);
+    for(j=0; j<5; j++) {
+        if (j < sizeof(int32_t)) {
+            sync_cmd = SYNC_DATA | ((uint8_t *)&data)[j];
+        } else {
+            sync_cmd = SYNC_MOT_PARAM | PACK_MOT_PARAM_ADDR(addr) | PACK_MOT_PARAM_ID(joint);
+        }
+        memcpy(buf[j], &sync_cmd, sizeof(uint16_t));
+        ops[j].func = WB_WR_CMD;
+        ops[j].wb_addr = (uint16_t) (JCMD_BASE | JCMD_SYNC_CMD);
+        ops[j].dsize = sizeof(uint16_t);
+        ops[j].data = buf[j];
     }
-
-    sync_cmd = SYNC_MOT_PARAM | PACK_MOT_PARAM_ADDR(addr) | PACK_MOT_PARAM_ID(joint);
-    memcpy(buf, &sync_cmd, sizeof(uint16_t));
-    wou_cmd(w_param, WB_WR_CMD, (uint16_t) (JCMD_BASE | JCMD_SYNC_CMD),
-            sizeof(uint16_t), buf);
+    // the SYNC_DATA words and their SYNC_MOT_PARAM in one wou frame
+    wou_cmd_batch(w_param, ops, 5);
     wou_flush(w_param);
 
     return;
@@ -316,6 +319,9 @@ int main(void)
     printf("after programming FPGA with %s...\n", FPGA_BIT);
 
     wou_prog_risc(&w_param, RISC_BIN);
+
+    // back to back SYNC commands go in one write, up to 32 bytes
+    wou_fifo_port(&w_param, JCMD_BASE | JCMD_SYNC_CMD, 32);
     
 //    mbox_fp = fopen ("./mbox.log", "w");
 //    fprintf(mbox_fp,"%11s%11s%11s%11s%11s%11s%11s%11s%11s%11s%11s\n","bp_tick","j0","j1","j2","j3","e0","e1","e2","e3","adc_spi","filtered adc");